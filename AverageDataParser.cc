@@ -9,7 +9,16 @@
 #include <list>
 #include <math.h>
 #include <iomanip>
+#include <sstream>
 #include <exception>
+#include <stdexcept>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // Commonly used identifiers
 using std::string;
@@ -41,17 +50,50 @@ private:
 
 // Ctors:
 AverageDataParser::AverageDataParser( const string& fname ) 
-  : m_filename( fname ) {
+  : m_filename( fname ), m_datasection( "Data" ), 
+    m_covsection( "Covariances" ) {
+  parseFile( fname );
+}
+
+// Data set from sections "Data"+suffix and "Covariances"+suffix of an
+// already read file, see AverageDataStream:
+AverageDataParser::AverageDataParser( const INIParser::INIReader& reader,
+				      const string& fname, 
+				      const string& suffix )
+  : m_filename( fname ), m_datasection( "Data"+suffix ), 
+    m_covsection( "Covariances"+suffix ) {
+  parseReader( reader );
+}
+
+// Load from the binary cache if it matches the contents of fname,
+// else parse fname and write the cache:
+AverageDataParser::AverageDataParser( const string& fname, 
+				      const string& cachename ) 
+  : m_filename( fname ), m_datasection( "Data" ), 
+    m_covsection( "Covariances" ) {
+  if( not readCache( cachename ) ) {
+    parseFile( fname );
+    writeCache( cachename );
+  }
+}
+
+void AverageDataParser::parseFile( const string& fname ) {
   INIParser::INIReader reader( fname );
   if( reader.parseError() != 0 ) {
     throw ParserError( reader.parseError(), fname.c_str() );
   }
+  parseReader( reader );
+  return;
+}
+void AverageDataParser::parseReader( const INIParser::INIReader& reader ) {
   makeNames( reader );
   makeValues( reader );
   makeGroups( reader );
   makeErrorsAndOptions( reader );
+  makeCovoptionTypes();
   makeCorrelations( reader );
   initialise();
+  return;
 }
 
 AverageDataParser::AverageDataParser( const vector<string>& names,
@@ -61,8 +103,13 @@ AverageDataParser::AverageDataParser( const vector<string>& names,
 				      StringMap correlations,
 				      vector<string> groups ) :
   m_filename( "NONE" ), m_names( names ), m_values( values ), 
-  m_errors( errors ), m_covopts( covopts ), m_correlations( correlations ), 
-  m_groups( groups ) {
+  m_errors( errors ), m_covopts( covopts ), m_groups( groups ) {
+  makeCovoptionTypes();
+  for( StringMap::const_iterator mapitr= correlations.begin();
+       mapitr != correlations.end(); mapitr++ ) {
+    storeCorrelations( mapitr->first, 
+		       INIParser::getTokens( mapitr->second ) );
+  }
   initialise();
 }
 
@@ -70,15 +117,15 @@ void AverageDataParser::initialise() {
   checkRelativeErrors();
   makeCovariances();
   makeTotalErrors();
-  makeGroupMatrix();  
+  makeGroupMap();
 }
 
 // Return data values:
-TVectorD AverageDataParser::getValues() const {
+const TVectorD& AverageDataParser::getValues() const {
   return m_values;
 }
 void AverageDataParser::makeValues( const INIParser::INIReader& reader ) {
-  string valuestring= reader.get( "Data", "values", "" );
+  string valuestring= reader.get( m_datasection, "values", "" );
   vector<string> valuetokens= INIParser::getTokens( valuestring );
   size_t ntok= valuetokens.size();
   m_values.ResizeTo( ntok );
@@ -90,27 +137,36 @@ void AverageDataParser::makeValues( const INIParser::INIReader& reader ) {
 }
 
 // Return all variable names:
-vector<string> AverageDataParser::getNames() const {
+const vector<string>& AverageDataParser::getNames() const {
   return m_names;
 }
 void AverageDataParser::makeNames( const INIParser::INIReader& reader ) {
-  string namestring= reader.get( "Data", "names", "" );
+  string namestring= reader.get( m_datasection, "names", "" );
   m_names= INIParser::getTokens( namestring );
   return;
 }
 
 // Return groups information:
-vector<string> AverageDataParser::getGroups() const {
+const vector<string>& AverageDataParser::getGroups() const {
   return m_groups;
 }
-vector<string> AverageDataParser::getUniqueGroups() const {
+const vector<string>& AverageDataParser::getUniqueGroups() const {
   return m_uniquegroups;
 }
-TMatrixD AverageDataParser::getGroupMatrix() const {
+const GroupMap& AverageDataParser::getGroupMap() const {
+  return m_groupmap;
+}
+// Dense group matrix made on first use:
+const TMatrixD& AverageDataParser::getGroupMatrix() const {
+  if( m_groupmatrix.GetNrows() != m_groupmap.getNvar() or
+      m_groupmatrix.GetNcols() != m_groupmap.getNgroups() ) {
+    m_groupmatrix.ResizeTo( m_groupmap.getNvar(), m_groupmap.getNgroups() );
+    m_groupmatrix= m_groupmap.getMatrix();
+  }
   return m_groupmatrix;
 }
 void AverageDataParser::makeGroups( const INIParser::INIReader& reader ) {
-  string groupsstring= reader.get( "Data", "groups", "" );
+  string groupsstring= reader.get( m_datasection, "groups", "" );
   if( !( groupsstring == "" ) ) {
     vector<string> grouptokens= INIParser::getTokens( groupsstring );
     for( size_t itok= 0; itok != grouptokens.size(); itok++ ) {
@@ -123,36 +179,76 @@ void AverageDataParser::makeGroups( const INIParser::INIReader& reader ) {
     }
   }
 }
-void AverageDataParser::makeGroupMatrix() {
+// Measurements without groups all belong to one group "a":
+void AverageDataParser::makeGroupMap() {
+  if( m_groups.empty() ) m_groups.assign( m_values.GetNoElements(), "a" );
   m_uniquegroups= m_groups;
   std::sort( m_uniquegroups.begin(), m_uniquegroups.end() );
   vector<string>::iterator uniqueend= std::unique( m_uniquegroups.begin(), 
 						   m_uniquegroups.end() );
   m_uniquegroups.resize( uniqueend - m_uniquegroups.begin() );
-  m_groupmatrix.ResizeTo( m_groups.size(), m_uniquegroups.size() );
+  vector<Int_t> indices( m_groups.size() );
   for( size_t igroup= 0; igroup < m_groups.size(); igroup++ ) {
-    vector<string>::iterator itr= std::find( m_uniquegroups.begin(), 
-					     m_uniquegroups.end(), 
-					     m_groups[igroup] );
-    if( itr != m_uniquegroups.end() ) {
-      size_t groupindex= itr - m_uniquegroups.begin();
-      m_groupmatrix( igroup, groupindex )= 1.0;
-    }
+    indices[igroup]= std::lower_bound( m_uniquegroups.begin(), 
+				       m_uniquegroups.end(), 
+				       m_groups[igroup] ) - 
+      m_uniquegroups.begin();
   }
+  m_groupmap= GroupMap( m_uniquegroups.size(), indices );
   return;
 }
 
 
 // Return map of error values for each error category:
-VectorMap AverageDataParser::getErrors() const {
+const VectorMap& AverageDataParser::getErrors() const {
   return m_errors;
 }
 
 // Return map of covariance options
-map<string, string> AverageDataParser::getCovoption() const {
+const StringMap& AverageDataParser::getCovoption() const {
   return m_covopts;
 }
 
+// Parse covariance options once, gpr before gp before the single
+// letters u, p, f, a and then c and m:
+static covoption_t parseCovoption( const string& covopt ) {
+  covoption_t option;
+  option.relative= covopt.find( "%" ) != string::npos;
+  if( covopt.find( "gpr" ) != string::npos ) {
+    option.type= kGlobalPartialRelative;
+  }
+  else if( covopt.find( "gp" ) != string::npos ) option.type= kGlobalPartial;
+  else if( covopt.find( "u" ) != string::npos ) option.type= kUncorrelated;
+  else if( covopt.find( "p" ) != string::npos ) option.type= kPartial;
+  else if( covopt.find( "f" ) != string::npos ) option.type= kFull;
+  else if( covopt.find( "a" ) != string::npos ) option.type= kAnti;
+  else if( covopt.find( "c" ) != string::npos ) {
+    option.type= kCorrelationMatrix;
+  }
+  else if( covopt.find( "m" ) != string::npos ) option.type= kLetterMatrix;
+  else option.type= kUnknown;
+  return option;
+}
+// Letters of option m matrices:
+static CovarianceType parseLetter( const string& letter ) {
+  CovarianceType type= kUnknown;
+  if( letter.find( "u" ) != string::npos ) type= kUncorrelated;
+  else if( letter.find( "p" ) != string::npos ) type= kPartial;
+  else if( letter.find( "f" ) != string::npos ) type= kFull;
+  else if( letter.find( "a" ) != string::npos ) type= kAnti;
+  return type;
+}
+const CovoptionMap& AverageDataParser::getCovoptionTypes() const {
+  return m_covtypes;
+}
+void AverageDataParser::makeCovoptionTypes() {
+  m_covtypes.clear();
+  for( StringMap::const_iterator mapitr= m_covopts.begin();
+       mapitr != m_covopts.end(); mapitr++ ) {
+    m_covtypes[mapitr->first]= parseCovoption( mapitr->second );
+  }
+  return;
+}
 // Read errors and covariance options from Data section:
 // Predicate for remove_if below:
 class Match {
@@ -168,7 +264,7 @@ void AverageDataParser::checkRelativeErrors() {
   for( VectorMap::iterator mapitr= m_errors.begin();
        mapitr != m_errors.end(); mapitr++ ) {
     string errorkey= mapitr->first;
-    if( m_covopts[errorkey].find( "%" ) != string::npos ) {
+    if( m_covtypes[errorkey].relative ) {
       TVectorD& errors= mapitr->second;
       for( Int_t ierr= 0; ierr != errors.GetNoElements(); ierr++ ) {
         errors[ierr]*= m_values[ierr] / 100.0;
@@ -178,7 +274,7 @@ void AverageDataParser::checkRelativeErrors() {
 }
 void AverageDataParser::makeErrorsAndOptions( const INIParser::INIReader& 
 					      reader ) {
-  vector<string> keys= reader.getNames( "Data" );
+  vector<string> keys= reader.getNames( m_datasection );
   vector<string> removekeys;
   removekeys.push_back( "names" );
   removekeys.push_back( "values" );
@@ -190,7 +286,7 @@ void AverageDataParser::makeErrorsAndOptions( const INIParser::INIReader&
   }
   for( size_t ikey= 0; ikey != keys.size(); ikey++ ) {
     string key= keys[ikey];
-    string elementstring= reader.get( "Data", key, "" );
+    string elementstring= reader.get( m_datasection, key, "" );
     vector<string> elementtokens= INIParser::getTokens( elementstring );
     string covopt= elementtokens.back();
     m_covopts[key]= covopt;
@@ -209,11 +305,12 @@ void AverageDataParser::makeErrorsAndOptions( const INIParser::INIReader&
 }
 
 // Return total errors for each variable:
-TVectorD AverageDataParser::getTotalErrors() const {
+const TVectorD& AverageDataParser::getTotalErrors() const {
   return m_totalerrors;
 }
 void AverageDataParser::makeTotalErrors() {
   m_totalerrors.ResizeTo( m_values.GetNoElements() );
+  m_totalerrors.Zero();
   for( VectorMap::const_iterator itr= m_errors.begin(); 
        itr != m_errors.end(); itr++ ) {
     const TVectorD& errors= itr->second;
@@ -227,191 +324,696 @@ void AverageDataParser::makeTotalErrors() {
   return;
 }
 
-// Return sums of covariance matrices:
+// Return sums of covariance matrices, added source by source without
+// making the dense matrices of compact sources:
 TMatrixDSym AverageDataParser::getTotalReducedCovariances() const {
-  return sumOverMatrixMap( m_reducedCovariances );
+  return sumOverCovarianceMap( m_reducedcovsources );
 }
 TMatrixDSym AverageDataParser::getTotalCovariances() const {
-  return sumOverMatrixMap( m_covariances );
+  return sumOverCovarianceMap( m_covsources );
 }
-TMatrixDSym AverageDataParser::sumOverMatrixMap( const MatrixMap& matrixmap ) const {
+TMatrixDSym 
+AverageDataParser::sumOverCovarianceMap( const CovarianceMap& covmap ) const {
   Int_t ndim= m_values.GetNoElements();
   TMatrixDSym total( ndim );
-  for( MatrixMap::const_iterator mapitr= matrixmap.begin();
-       mapitr != matrixmap.end(); mapitr++ ) {
-    total+= mapitr->second;
+  for( CovarianceMap::const_iterator mapitr= covmap.begin();
+       mapitr != covmap.end(); mapitr++ ) {
+    mapitr->second.addTo( total );
   }
   return total;
 }
 
-// Read detailed correlation information as a string from extra section
-// "Covariances" if indicated by option in "Data" section.
-// On failure the map contains empty strings.
-StringMap AverageDataParser::getCorrelations() const {
+// Read detailed correlation information from extra section
+// "Covariances" if indicated by option in "Data" section. The tokens are
+// converted once to a numeric N x N matrix for option c and to a row 
+// major table of letter op-codes for option m. No strings are kept, 
+// getCorrelations makes them on first use:
+const StringMap& AverageDataParser::getCorrelations() const {
+  if( m_correlations.size() != 
+      m_corrmatrices.size()+m_lettermatrices.size() ) {
+    makeCorrelationStrings();
+  }
   return m_correlations;
 }
+const CorrelationMap& AverageDataParser::getCorrelationMatrices() const {
+  return m_corrmatrices;
+}
+const LetterMatrixMap& AverageDataParser::getLetterMatrices() const {
+  return m_lettermatrices;
+}
 void AverageDataParser::makeCorrelations( const INIParser::INIReader& reader ) {
-  for( map<string, string>::const_iterator itr= m_covopts.begin();
-       itr != m_covopts.end(); itr++ ) {
-    string covopt= itr->second;
-    if( covopt.find( "c" ) != string::npos or 
-	covopt.find( "m" ) != string::npos ) {
+  for( CovoptionMap::const_iterator itr= m_covtypes.begin();
+       itr != m_covtypes.end(); itr++ ) {
+    CovarianceType type= itr->second.type;
+    if( type == kCorrelationMatrix or type == kLetterMatrix ) {
       string key= itr->first;
-      string covariancesstring= reader.get( "Covariances", key, "" );
-      vector<string> covariancestokens= 
-	INIParser::getTokens( covariancesstring );
-      string str;
-      size_t ntok= covariancestokens.size();
-      for( size_t itok= 0; itok < ntok; itok++ ) {
-	str+= covariancestokens[itok];
-	if( itok < ntok-1 ) str+= " ";
+      storeCorrelations( key, 
+			 INIParser::getTokens( reader.get( m_covsection, 
+							   key, "" ) ) );
+      m_filecorrelations.insert( key );
+    }
+  }
+  return;
+}
+void AverageDataParser::storeCorrelations( const string& errorkey,
+					   const vector<string>& tokens ) {
+  CovoptionMap::const_iterator typeitr= m_covtypes.find( errorkey );
+  if( typeitr == m_covtypes.end() ) return;
+  TMatrixD corrmatrix;
+  LetterMatrix letters;
+  parseCorrelations( errorkey, typeitr->second.type, tokens, corrmatrix, 
+		     letters );
+  storeCorrelations( errorkey, typeitr->second.type, corrmatrix, letters );
+  return;
+}
+// Tokens to matrix or letters without touching the members:
+void AverageDataParser::parseCorrelations( const string& errorkey,
+					   CovarianceType type,
+					   const vector<string>& tokens,
+					   TMatrixD& corrmatrix,
+					   LetterMatrix& letters ) const {
+  if( type == kCorrelationMatrix ) {
+    Int_t nerr= m_values.GetNoElements();
+    if( tokens.size() < size_t( nerr*nerr ) ) {
+      throw std::out_of_range( "correlations of " + errorkey + 
+			       " too short" );
+    }
+    corrmatrix.ResizeTo( nerr, nerr );
+    for( Int_t ierr= 0; ierr < nerr; ierr++ ) {
+      for( Int_t jerr= 0; jerr < nerr; jerr++ ) {
+	corrmatrix(ierr,jerr)= 
+	  INIParser::stringToType( tokens[ierr*nerr+jerr], 0.0 );
       }
-      m_correlations[key]= str;
     }
   }
+  else if( type == kLetterMatrix ) {
+    letters.resize( tokens.size() );
+    for( size_t itok= 0; itok < tokens.size(); itok++ ) {
+      letters[itok]= parseLetter( tokens[itok] );
+    }
+  }
+  return;
+}
+// Takes over corrmatrix or letters, does not throw:
+void AverageDataParser::storeCorrelations( const string& errorkey,
+					   CovarianceType type,
+					   TMatrixD& corrmatrix,
+					   LetterMatrix& letters ) {
+  m_correlations.erase( errorkey );
+  m_filecorrelations.erase( errorkey );
+  if( type == kCorrelationMatrix ) {
+    TMatrixD& stored= m_corrmatrices[errorkey];
+    stored.ResizeTo( corrmatrix );
+    stored= corrmatrix;
+  }
+  else if( type == kLetterMatrix ) {
+    m_lettermatrices[errorkey].swap( letters );
+  }
+  return;
+}
+// Letters for printing, types without letter as "-":
+static string letterString( CovarianceType type ) {
+  switch( type ) {
+  case kUncorrelated: return "u";
+  case kPartial: return "p";
+  case kFull: return "f";
+  case kAnti: return "a";
+  default: return "-";
+  }
+}
+// Only for sources without string: sources unchanged since they were
+// read from the file get the tokens as written there, the others strings
+// made from the matrices:
+void AverageDataParser::makeCorrelationStrings() const {
+  if( not m_filecorrelations.empty() ) readCorrelationStrings();
+  for( CorrelationMap::const_iterator mapitr= m_corrmatrices.begin();
+       mapitr != m_corrmatrices.end(); mapitr++ ) {
+    if( m_correlations.count( mapitr->first ) > 0 ) continue;
+    const TMatrixD& corrmatrix= mapitr->second;
+    std::ostringstream strstr;
+    for( Int_t ierr= 0; ierr < corrmatrix.GetNrows(); ierr++ ) {
+      for( Int_t jerr= 0; jerr < corrmatrix.GetNcols(); jerr++ ) {
+	if( ierr > 0 or jerr > 0 ) strstr << " ";
+	strstr << corrmatrix(ierr,jerr);
+      }
+    }
+    m_correlations[mapitr->first]= strstr.str();
+  }
+  for( LetterMatrixMap::const_iterator mapitr= m_lettermatrices.begin();
+       mapitr != m_lettermatrices.end(); mapitr++ ) {
+    if( m_correlations.count( mapitr->first ) > 0 ) continue;
+    const LetterMatrix& letters= mapitr->second;
+    string str;
+    for( size_t itok= 0; itok < letters.size(); itok++ ) {
+      str+= letterString( CovarianceType( letters[itok] ) );
+      if( itok < letters.size()-1 ) str+= " ";
+    }
+    m_correlations[mapitr->first]= str;
+  }
+  return;
+}
+void AverageDataParser::readCorrelationStrings() const {
+  INIParser::INIReader reader( m_filename );
+  if( reader.parseError() != 0 ) return;
+  for( std::set<string>::const_iterator keyitr= m_filecorrelations.begin();
+       keyitr != m_filecorrelations.end(); keyitr++ ) {
+    if( m_correlations.count( *keyitr ) > 0 ) continue;
+    vector<string> tokens= 
+      INIParser::getTokens( reader.get( m_covsection, *keyitr, "" ) );
+    if( tokens.empty() ) continue;
+    string str;
+    for( size_t itok= 0; itok < tokens.size(); itok++ ) {
+      str+= tokens[itok];
+      if( itok < tokens.size()-1 ) str+= " ";
+    }
+    m_correlations[*keyitr]= str;
+  }
   return;
 }
 
-// Getters for covariances:
-MatrixMap AverageDataParser::getCovariances() const {
+// Getters for covariances, the dense matrices are made on first use:
+const CovarianceMap& AverageDataParser::getCovarianceSources() const {
+  return m_covsources;
+}
+const CovarianceMap& AverageDataParser::getReducedCovarianceSources() const {
+  return m_reducedcovsources;
+}
+const MatrixMap& AverageDataParser::getCovariances() const {
+  if( m_covariances.size() != m_covsources.size() ) {
+    makeMatrixMap( m_covsources, m_covariances );
+  }
   return m_covariances;
 }
-MatrixMap AverageDataParser::getReducedCovariances() const {
+const MatrixMap& AverageDataParser::getReducedCovariances() const {
+  if( m_reducedCovariances.size() != m_reducedcovsources.size() ) {
+    makeMatrixMap( m_reducedcovsources, m_reducedCovariances );
+  }
   return m_reducedCovariances;
 }
-map<int,TVectorD> AverageDataParser::getSysterrorMatrix() const {
+void AverageDataParser::makeMatrixMap( const CovarianceMap& covmap,
+				       MatrixMap& matrixmap ) const {
+  matrixmap.clear();
+  for( CovarianceMap::const_iterator mapitr= covmap.begin();
+       mapitr != covmap.end(); mapitr++ ) {
+    matrixmap.insert( MatrixMap::value_type( mapitr->first,
+					     mapitr->second.getMatrix() ) );
+  }
+  return;
+}
+const map<int,TVectorD>& AverageDataParser::getSysterrorMatrix() const {
   return m_systerrmatrix;
 }
-// Helper to calculate covariances from errors and options u, p, f, a:
-Double_t AverageDataParser::calcCovariance( const string& covopt, 
+// Helper to calculate covariances from errors and types u, p, f, a:
+Double_t AverageDataParser::calcCovariance( CovarianceType type,
 					    const TVectorD& errors, 
-					    size_t ierr, size_t jerr ) const {
+					    Int_t ierr, Int_t jerr ) const {
   Double_t cov= 0.0;
-  if( covopt.find( "u" ) != string::npos ) {
+  switch( type ) {
+  case kUncorrelated:
     if( ierr == jerr ) cov= errors[ierr]*errors[ierr];
-  }
-  else if( covopt.find( "p" ) != string::npos ) {
+    break;
+  case kPartial:
     cov= pow( std::min( errors[ierr], errors[jerr] ), 2 );
-  }
-  else if( covopt.find( "f" ) != string::npos ) {
+    break;
+  case kFull:
     cov= errors[ierr]*errors[jerr];
-  }
-  else if( covopt.find( "a" ) != string::npos ) {
+    break;
+  case kAnti:
     if( ierr == jerr ) cov= errors[ierr]*errors[ierr];
     else cov= - errors[ierr]*errors[jerr];
+    break;
+  default:
+    break;
   }
   return cov;
 }
-// Calculate covariances:
+// Calculate covariances, options u, f, a, gp and gpr are stored as
+// diagonal plus rank-one term, p, c and m as dense matrices:
 void AverageDataParser::makeCovariances() {
-  int nsysterr;
-  VectorMap::const_iterator mapitr;
-  for( mapitr= m_errors.begin(), nsysterr= 0; 
-       mapitr != m_errors.end(); mapitr++, nsysterr++ ) {
-    string errorkey= mapitr->first;
-    TVectorD errors= mapitr->second;
-    Int_t nerr= errors.GetNoElements();
-    string covopt= m_covopts.find( errorkey )->second;
-    TMatrixDSym covm( nerr );
-    TMatrixDSym reducedcovm( nerr );
-    if( covopt.find( "gpr" ) != string::npos ) {
-      TVectorD ratios( nerr );
-      TVectorD systerrs( nerr );
-      for( Int_t ierr= 0; ierr < nerr; ierr++ ) {
-      	ratios[ierr]= errors[ierr]/m_values[ierr];
-      }
-      Double_t minrelerr= ratios.Min();
-      for( Int_t ierr= 0; ierr < nerr; ierr++ ) {
-	for( Int_t jerr= 0; jerr < nerr; jerr++ ) {
-	  if( ierr == jerr ) {
-	    covm(ierr,ierr)= errors[ierr]*errors[ierr];
-	    reducedcovm(ierr,ierr)= 
-	      std::max( pow( errors[ierr], 2 ) -
-			pow( minrelerr*m_values[ierr], 2 ), 0.0 );
-	  }
-	  else {
-	    covm(ierr,jerr)= minrelerr*minrelerr*m_values[ierr]*m_values[jerr];
-	  }
-	}
-	systerrs[ierr]= minrelerr*m_values[ierr];
-      }
-      m_systerrmatrix.insert( map<int,TVectorD>::value_type( nsysterr, 
-							     systerrs ) );
-    }
-    else if( covopt.find( "gp" ) != string::npos ) {
-      Double_t minerr= errors.Min();
-      TVectorD systerrs( nerr );
-      for( Int_t ierr= 0; ierr < nerr; ierr++ ) {
-	for( Int_t jerr= 0; jerr < nerr; jerr++ ) {
-	  if( ierr == jerr ) {
-	    covm(ierr,ierr)= errors[ierr]*errors[ierr];
-	    reducedcovm(ierr,ierr)= errors[ierr]*errors[ierr]-minerr*minerr;
-	  }
-	  else {
-	    covm(ierr,jerr)= minerr*minerr;
-	  }
-	}
-	systerrs[ierr]= minerr;
-      }
-      m_systerrmatrix.insert( map<int,TVectorD>::value_type( nsysterr, 
-							     systerrs ) );
-    }
-    else if( covopt.find( "u" ) != string::npos or
-	     covopt.find( "p" ) != string::npos or
-	     covopt.find( "f" ) != string::npos or
-	     covopt.find( "a" ) != string::npos ) {
-      for( Int_t ierr= 0; ierr < nerr; ierr++ ) {
-	for( Int_t jerr= 0; jerr < nerr; jerr++ ) {
-	  covm(ierr,jerr)= calcCovariance( covopt, errors, ierr, jerr );
-	}
-      }
-      if( covopt.find( "f" ) != string::npos ) {
-	m_systerrmatrix.insert( map<int,TVectorD>::value_type( nsysterr, 
-							       errors ) );
+  m_covsources.clear();
+  m_reducedcovsources.clear();
+  m_systerrors.clear();
+  for( VectorMap::const_iterator mapitr= m_errors.begin();
+       mapitr != m_errors.end(); mapitr++ ) {
+    makeCovariance( mapitr->first );
+  }
+  makeSysterrorMatrix();
+  return;
+}
+// Covariances of one error source, replaces previous entries:
+void AverageDataParser::makeCovariance( const string& errorkey ) {
+  const TVectorD& errors= m_errors.find( errorkey )->second;
+  Int_t nerr= errors.GetNoElements();
+  CorrelationMap::const_iterator corritr= m_corrmatrices.find( errorkey );
+  LetterMatrixMap::const_iterator letteritr= 
+    m_lettermatrices.find( errorkey );
+  CovarianceSource covm( nerr );
+  CovarianceSource reducedcovm( nerr );
+  TVectorD systerrs;
+  buildCovariance( errorkey, m_covtypes.find( errorkey )->second.type, 
+		   errors, 
+		   corritr != m_corrmatrices.end() ? &corritr->second : 0,
+		   letteritr != m_lettermatrices.end() ? 
+		   &letteritr->second : 0, 
+		   covm, reducedcovm, systerrs );
+  storeCovariance( errorkey, covm, reducedcovm, systerrs );
+  return;
+}
+void AverageDataParser::storeCovariance( const string& errorkey,
+					 const CovarianceSource& covm,
+					 const CovarianceSource& reducedcovm,
+					 const TVectorD& systerrs ) {
+  m_covariances.clear();
+  m_reducedCovariances.clear();
+  m_systerrors.erase( errorkey );
+  if( systerrs.GetNoElements() > 0 ) {
+    m_systerrors.insert( VectorMap::value_type( errorkey, systerrs ) );
+  }
+  m_covsources[errorkey]= covm;
+  m_reducedcovsources[errorkey]= reducedcovm;
+  return;
+}
+// Covariances from the errors and, for options c and m, the correlation
+// or letter matrix without touching the members. systerrs is left empty
+// for sources without systematic errors:
+void AverageDataParser::buildCovariance( const string& errorkey,
+					 CovarianceType type,
+					 const TVectorD& errors,
+					 const TMatrixD* corrmatrix,
+					 const LetterMatrix* letters,
+					 CovarianceSource& covm,
+					 CovarianceSource& reducedcovm,
+					 TVectorD& systerrs ) const {
+  Int_t nerr= errors.GetNoElements();
+  switch( type ) {
+  case kGlobalPartialRelative: {
+    TVectorD ratios( nerr );
+    for( Int_t ierr= 0; ierr < nerr; ierr++ ) {
+    	ratios[ierr]= errors[ierr]/m_values[ierr];
+    }
+    Double_t minrelerr= ratios.Min();
+    systerrs.ResizeTo( nerr );
+    TVectorD diagonal( nerr );
+    TVectorD reduceddiagonal( nerr );
+    for( Int_t ierr= 0; ierr < nerr; ierr++ ) {
+      systerrs[ierr]= minrelerr*m_values[ierr];
+      diagonal[ierr]= pow( errors[ierr], 2 ) - pow( systerrs[ierr], 2 );
+      reduceddiagonal[ierr]= std::max( diagonal[ierr], 0.0 );
+    }
+    covm= CovarianceSource( diagonal, systerrs );
+    reducedcovm= CovarianceSource( reduceddiagonal );
+    break;
+  }
+  case kGlobalPartial: {
+    Double_t minerr= errors.Min();
+    systerrs.ResizeTo( nerr );
+    TVectorD diagonal( nerr );
+    for( Int_t ierr= 0; ierr < nerr; ierr++ ) {
+      systerrs[ierr]= minerr;
+      diagonal[ierr]= errors[ierr]*errors[ierr]-minerr*minerr;
+    }
+    covm= CovarianceSource( diagonal, systerrs );
+    reducedcovm= CovarianceSource( diagonal );
+    break;
+  }
+  case kUncorrelated: {
+    TVectorD diagonal( nerr );
+    for( Int_t ierr= 0; ierr < nerr; ierr++ ) {
+      diagonal[ierr]= errors[ierr]*errors[ierr];
+    }
+    covm= CovarianceSource( diagonal );
+    reducedcovm= covm;
+    break;
+  }
+  case kPartial: {
+    TMatrixDSym matrix( nerr );
+    for( Int_t ierr= 0; ierr < nerr; ierr++ ) {
+      for( Int_t jerr= 0; jerr < nerr; jerr++ ) {
+	Double_t minerr= std::min( errors[ierr], errors[jerr] );
+	matrix(ierr,jerr)= minerr*minerr;
       }
-      else {
-	reducedcovm= covm;
+    }
+    covm= CovarianceSource( matrix );
+    reducedcovm= covm;
+    break;
+  }
+  case kFull:
+    covm= CovarianceSource( TVectorD( nerr ), errors );
+    systerrs.ResizeTo( errors );
+    systerrs= errors;
+    break;
+  case kAnti: {
+    TVectorD diagonal( nerr );
+    for( Int_t ierr= 0; ierr < nerr; ierr++ ) {
+      diagonal[ierr]= 2.0*errors[ierr]*errors[ierr];
+    }
+    covm= CovarianceSource( diagonal, errors, -1.0 );
+    reducedcovm= covm;
+    break;
+  }
+  case kCorrelationMatrix: {
+    if( corrmatrix == 0 ) {
+      throw std::out_of_range( "no correlations for " + errorkey );
+    }
+    TMatrixDSym matrix( nerr );
+    for( Int_t ierr= 0; ierr < nerr; ierr++ ) {
+      for( Int_t jerr= 0; jerr < nerr; jerr++ ) {
+	matrix(ierr,jerr)= (*corrmatrix)(ierr,jerr)*errors[ierr]*errors[jerr];
       }
     }
-    else if( covopt.find( "c" ) != string::npos ) {
-      string corrstr= m_correlations[errorkey];
-      vector<string> corrtokens= INIParser::getTokens( corrstr );
-      for( Int_t ierr= 0; ierr < nerr; ierr++ ) {
-	for( Int_t jerr= 0; jerr < nerr; jerr++ ) {
-	  Double_t corr= 
-	    INIParser::stringToType( corrtokens.at( ierr*nerr+jerr ), 0.0 );
-	  covm(ierr,jerr)= corr*errors[ierr]*errors[jerr];
-	}
+    covm= CovarianceSource( matrix );
+    reducedcovm= covm;
+    break;
+  }
+  case kLetterMatrix: {
+    if( letters == 0 or letters->size() < size_t( nerr*nerr ) ) {
+      throw std::out_of_range( "letter matrix of " + errorkey + 
+			       " too small" );
+    }
+    TMatrixDSym matrix( nerr );
+    bool full= false;
+    bool partial= false;
+    for( Int_t ierr= 0; ierr < nerr; ierr++ ) {
+      const unsigned char* row= &(*letters)[ierr*nerr];
+      for( Int_t jerr= 0; jerr < nerr; jerr++ ) {
+	CovarianceType letter= CovarianceType( row[jerr] );
+	matrix(ierr,jerr)= calcCovariance( letter, errors, ierr, jerr );
+	if( letter == kFull ) full= true;
+	if( letter == kPartial ) partial= true;
       }
+    }
+    covm= CovarianceSource( matrix );
+    if( full and not partial ) {
+      systerrs.ResizeTo( errors );
+      systerrs= errors;
+    }
+    else {
       reducedcovm= covm;
     }
-    else if( covopt.find( "m" ) != string::npos ) {
-      string corrstr= m_correlations[errorkey];
-      vector<string> corrtokens= INIParser::getTokens( corrstr );
-      for( Int_t ierr= 0; ierr < nerr; ierr++ ) {
-	for( Int_t jerr= 0; jerr < nerr; jerr++ ) {
-	  covm(ierr,jerr)= calcCovariance( corrtokens.at( ierr*nerr+jerr ), 
-					   errors, ierr, jerr );
+    break;
+  }
+  default:
+    std::cerr << "Covoption of " << errorkey 
+	      << " not recognised" << std::endl;
+    break;
+  }
+  return;
+}
+// Systematic errors indexed by position of the error source:
+void AverageDataParser::makeSysterrorMatrix() {
+  m_systerrmatrix.clear();
+  int nsysterr= 0;
+  for( VectorMap::const_iterator mapitr= m_errors.begin();
+       mapitr != m_errors.end(); mapitr++, nsysterr++ ) {
+    VectorMap::const_iterator systitr= m_systerrors.find( mapitr->first );
+    if( systitr != m_systerrors.end() ) {
+      m_systerrmatrix.insert( map<int,TVectorD>::value_type( nsysterr, 
+							     systitr->second ) );
+    }
+  }
+  return;
+}
+
+
+// Mutators, only the covariances of the error sources concerned are
+// rebuilt. Errors are given as in the input, i.e. in percent of the
+// values for relative (%) options:
+void AverageDataParser::checkIndex( Int_t ivar ) const {
+  if( ivar < 0 or ivar >= m_values.GetNoElements() ) {
+    std::stringstream strstr;
+    strstr << "measurement index " << ivar << " out of range";
+    throw std::out_of_range( strstr.str() );
+  }
+  return;
+}
+VectorMap::iterator AverageDataParser::findErrors( const string& errorkey ) {
+  VectorMap::iterator erritr= m_errors.find( errorkey );
+  if( erritr == m_errors.end() ) {
+    throw std::invalid_argument( "error source " + errorkey + " not found" );
+  }
+  return erritr;
+}
+// Only gpr covariances depend on the values, absolute errors are kept:
+void AverageDataParser::setValue( Int_t ivar, Double_t value ) {
+  checkIndex( ivar );
+  m_values[ivar]= value;
+  for( CovoptionMap::const_iterator mapitr= m_covtypes.begin();
+       mapitr != m_covtypes.end(); mapitr++ ) {
+    if( mapitr->second.type == kGlobalPartialRelative ) {
+      makeCovariance( mapitr->first );
+    }
+  }
+  makeSysterrorMatrix();
+  return;
+}
+void AverageDataParser::setError( const string& errorkey, Int_t ivar, 
+				  Double_t error ) {
+  checkIndex( ivar );
+  TVectorD& errors= findErrors( errorkey )->second;
+  if( m_covtypes[errorkey].relative ) error*= m_values[ivar]/100.0;
+  errors[ivar]= error;
+  makeCovariance( errorkey );
+  makeSysterrorMatrix();
+  makeTotalErrors();
+  return;
+}
+void AverageDataParser::addErrorSource( const string& errorkey, 
+					const TVectorD& errors,
+					const string& covopt,
+					const string& correlations ) {
+  if( m_errors.find( errorkey ) != m_errors.end() ) {
+    throw std::invalid_argument( "error source " + errorkey + 
+				 " already present" );
+  }
+  Int_t nerr= m_values.GetNoElements();
+  if( errors.GetNoElements() != nerr ) {
+    throw std::invalid_argument( "wrong number of errors for " + 
+				 errorkey );
+  }
+  covoption_t covtype= parseCovoption( covopt );
+  if( covtype.type == kUnknown ) {
+    throw std::invalid_argument( "covoption " + covopt + " of " + 
+				 errorkey + " not recognised" );
+  }
+  TVectorD newerrors( errors );
+  if( covtype.relative ) {
+    for( Int_t ierr= 0; ierr < nerr; ierr++ ) {
+      newerrors[ierr]*= m_values[ierr]/100.0;
+    }
+  }
+  // Everything which may throw is done before the members change:
+  vector<string> tokens= INIParser::getTokens( correlations );
+  TMatrixD corrmatrix;
+  LetterMatrix letters;
+  parseCorrelations( errorkey, covtype.type, tokens, corrmatrix, letters );
+  CovarianceSource covm( nerr );
+  CovarianceSource reducedcovm( nerr );
+  TVectorD systerrs;
+  buildCovariance( errorkey, covtype.type, newerrors, &corrmatrix, 
+		   &letters, covm, reducedcovm, systerrs );
+  m_covopts[errorkey]= covopt;
+  m_covtypes[errorkey]= covtype;
+  TVectorD& storederrors= m_errors[errorkey];
+  storederrors.ResizeTo( newerrors );
+  storederrors= newerrors;
+  storeCorrelations( errorkey, covtype.type, corrmatrix, letters );
+  storeCovariance( errorkey, covm, reducedcovm, systerrs );
+  makeSysterrorMatrix();
+  makeTotalErrors();
+  return;
+}
+void AverageDataParser::removeErrorSource( const string& errorkey ) {
+  m_errors.erase( findErrors( errorkey ) );
+  m_covopts.erase( errorkey );
+  m_covtypes.erase( errorkey );
+  m_corrmatrices.erase( errorkey );
+  m_lettermatrices.erase( errorkey );
+  m_correlations.erase( errorkey );
+  m_filecorrelations.erase( errorkey );
+  m_covsources.erase( errorkey );
+  m_reducedcovsources.erase( errorkey );
+  m_covariances.clear();
+  m_reducedCovariances.clear();
+  m_systerrors.erase( errorkey );
+  makeSysterrorMatrix();
+  makeTotalErrors();
+  return;
+}
+// Only for error sources with option c and i != j, sets both (i,j) and
+// (j,i):
+void AverageDataParser::setCorrelation( const string& errorkey, 
+					Int_t ivar, Int_t jvar, 
+					Double_t correlation ) {
+  checkIndex( ivar );
+  checkIndex( jvar );
+  if( ivar == jvar ) {
+    throw std::invalid_argument( "diagonal correlation of " + errorkey + 
+				 " is fixed" );
+  }
+  findErrors( errorkey );
+  CorrelationMap::iterator corritr= m_corrmatrices.find( errorkey );
+  if( corritr == m_corrmatrices.end() ) {
+    throw std::invalid_argument( "error source " + errorkey + 
+				 " has no correlation matrix" );
+  }
+  corritr->second(ivar,jvar)= correlation;
+  corritr->second(jvar,ivar)= correlation;
+  m_correlations.erase( errorkey );
+  m_filecorrelations.erase( errorkey );
+  makeCovariance( errorkey );
+  return;
+}
+
+// Append a measurement, errors are given per error source as in the
+// input and missing sources count as zero.  Correlations of c and m
+// sources with the existing measurements are given as one row of
+// tokens, optionally followed by the diagonal element, missing rows
+// mean uncorrelated:
+void AverageDataParser::addMeasurement( const string& name, Double_t value,
+					const ValueMap& errors,
+					const StringMap& correlations,
+					const string& group ) {
+  Int_t nvar= m_values.GetNoElements();
+  for( ValueMap::const_iterator valitr= errors.begin(); 
+       valitr != errors.end(); valitr++ ) {
+    findErrors( valitr->first );
+  }
+  map<string,vector<string> > rows;
+  for( StringMap::const_iterator stritr= correlations.begin(); 
+       stritr != correlations.end(); stritr++ ) {
+    const string& errorkey= stritr->first;
+    findErrors( errorkey );
+    CovarianceType type= m_covtypes[errorkey].type;
+    if( type != kCorrelationMatrix and type != kLetterMatrix ) {
+      throw std::invalid_argument( "error source " + errorkey + 
+				   " has no correlation matrix" );
+    }
+    vector<string> tokens= INIParser::getTokens( stritr->second );
+    if( tokens.size() != size_t( nvar ) and 
+	tokens.size() != size_t( nvar+1 ) ) {
+      throw std::invalid_argument( "wrong number of correlations for " + 
+				   errorkey );
+    }
+    rows[errorkey]= tokens;
+  }
+  m_names.push_back( name );
+  m_groups.push_back( group );
+  m_values.ResizeTo( nvar+1 );
+  m_values[nvar]= value;
+  for( VectorMap::iterator erritr= m_errors.begin(); 
+       erritr != m_errors.end(); erritr++ ) {
+    const string& errorkey= erritr->first;
+    TVectorD& errs= erritr->second;
+    errs.ResizeTo( nvar+1 );
+    ValueMap::const_iterator valitr= errors.find( errorkey );
+    if( valitr != errors.end() ) {
+      errs[nvar]= valitr->second;
+      if( m_covtypes[errorkey].relative ) errs[nvar]*= value/100.0;
+    }
+    map<string,vector<string> >::const_iterator rowitr= 
+      rows.find( errorkey );
+    CovarianceType type= m_covtypes[errorkey].type;
+    if( type == kCorrelationMatrix ) {
+      TMatrixD& corrmatrix= m_corrmatrices[errorkey];
+      corrmatrix.ResizeTo( nvar+1, nvar+1 );
+      corrmatrix(nvar,nvar)= 1.0;
+      if( rowitr != rows.end() and rowitr->second.size() > size_t( nvar ) ) {
+	corrmatrix(nvar,nvar)= 
+	  INIParser::stringToType( rowitr->second[nvar], 1.0 );
+      }
+      for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+	Double_t corr= 0.0;
+	if( rowitr != rows.end() ) {
+	  corr= INIParser::stringToType( rowitr->second[ivar], 0.0 );
 	}
+	corrmatrix(ivar,nvar)= corr;
+	corrmatrix(nvar,ivar)= corr;
       }
-      if( corrstr.find( "f" ) != string::npos and 
-	  corrstr.find( "p" ) == string::npos ) {
-	m_systerrmatrix.insert( map<int,TVectorD>::value_type( nsysterr, 
-							       errors ) );
+    }
+    else if( type == kLetterMatrix ) {
+      const LetterMatrix& letters= m_lettermatrices[errorkey];
+      LetterMatrix newletters( (nvar+1)*(nvar+1), kUncorrelated );
+      for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+	std::copy( &letters[ivar*nvar], &letters[ivar*nvar]+nvar,
+		   &newletters[ivar*(nvar+1)] );
+	unsigned char letter= kUncorrelated;
+	if( rowitr != rows.end() ) letter= parseLetter( rowitr->second[ivar] );
+	newletters[ivar*(nvar+1)+nvar]= letter;
+	newletters[nvar*(nvar+1)+ivar]= letter;
       }
-      else {
-	reducedcovm= covm;
+      if( rowitr != rows.end() and rowitr->second.size() > size_t( nvar ) ) {
+	newletters[nvar*(nvar+1)+nvar]= parseLetter( rowitr->second[nvar] );
       }
+      m_lettermatrices[errorkey].swap( newletters );
     }
-    else {
-      std::cerr << "Covoption " << covopt << " not recognised" << std::endl;
+  }
+  remakeMeasurements();
+  return;
+}
+// Helpers to drop one element, or one row and column:
+static TVectorD eraseElement( const TVectorD& vec, Int_t iskip ) {
+  TVectorD result( vec.GetNoElements()-1 );
+  for( Int_t i= 0, j= 0; i < vec.GetNoElements(); i++ ) {
+    if( i != iskip ) result[j++]= vec[i];
+  }
+  return result;
+}
+static TMatrixD eraseRowColumn( const TMatrixD& matrix, Int_t iskip ) {
+  Int_t n= matrix.GetNrows();
+  TMatrixD result( n-1, n-1 );
+  for( Int_t i= 0, ir= 0; i < n; i++ ) {
+    if( i == iskip ) continue;
+    for( Int_t j= 0, jr= 0; j < n; j++ ) {
+      if( j != iskip ) result(ir,jr++)= matrix(i,j);
+    }
+    ir++;
+  }
+  return result;
+}
+void AverageDataParser::removeMeasurement( Int_t ivar ) {
+  checkIndex( ivar );
+  Int_t nvar= m_values.GetNoElements();
+  m_names.erase( m_names.begin()+ivar );
+  m_groups.erase( m_groups.begin()+ivar );
+  TVectorD values= eraseElement( m_values, ivar );
+  m_values.ResizeTo( values );
+  m_values= values;
+  for( VectorMap::iterator erritr= m_errors.begin(); 
+       erritr != m_errors.end(); erritr++ ) {
+    TVectorD errs= eraseElement( erritr->second, ivar );
+    erritr->second.ResizeTo( errs );
+    erritr->second= errs;
+  }
+  for( CorrelationMap::iterator corritr= m_corrmatrices.begin(); 
+       corritr != m_corrmatrices.end(); corritr++ ) {
+    TMatrixD corrmatrix= eraseRowColumn( corritr->second, ivar );
+    corritr->second.ResizeTo( corrmatrix );
+    corritr->second= corrmatrix;
+  }
+  for( LetterMatrixMap::iterator letteritr= m_lettermatrices.begin(); 
+       letteritr != m_lettermatrices.end(); letteritr++ ) {
+    const LetterMatrix& letters= letteritr->second;
+    LetterMatrix newletters;
+    newletters.reserve( (nvar-1)*(nvar-1) );
+    for( Int_t i= 0; i < nvar; i++ ) {
+      for( Int_t j= 0; j < nvar; j++ ) {
+	if( i != ivar and j != ivar ) newletters.push_back( letters[i*nvar+j] );
+      }
     }
-    m_covariances.insert( MatrixMap::value_type( errorkey, covm ) );
-    m_reducedCovariances.insert( MatrixMap::value_type( errorkey, reducedcovm ) );
+    letteritr->second.swap( newletters );
   }
+  remakeMeasurements();
+  return;
+}
+// Covariances, totals and groups after the measurements changed:
+void AverageDataParser::remakeMeasurements() {
+  m_correlations.clear();
+  m_filecorrelations.clear();
+  makeCovariances();
+  makeTotalErrors();
+  makeGroupMap();
   return;
 }
-
 
 string AverageDataParser::stripLeadingDigits( const string& word ) const {
   size_t iposalpha= 0;
@@ -466,7 +1068,7 @@ void AverageDataParser::printErrors( std::ostream& ost ) const {
        mapitr != m_errors.end(); mapitr++ ) {
     string key= mapitr->first;
     ost << std::setw(11) << stripLeadingDigits( key )+":";
-    TVectorD errors= mapitr->second;
+    const TVectorD& errors= mapitr->second;
     for( Int_t ierr= 0; ierr < errors.GetNoElements(); ierr++ ) {
       ost << " " << std::setw(10) << errors[ierr];
     }
@@ -483,26 +1085,29 @@ void AverageDataParser::printTotalErrors( std::ostream& ost ) const {
   ost << endl;
 }
 void AverageDataParser::printCorrelations( std::ostream& ost ) const {
-  if( m_correlations.size() > 0 ) ost << "Correlations:" << endl;
-  for( StringMap::const_iterator mapitr= m_correlations.begin();
-       mapitr != m_correlations.end(); mapitr++ ) {
+  if( m_corrmatrices.size()+m_lettermatrices.size() > 0 ) {
+    ost << "Correlations:" << endl;
+  }
+  for( CovoptionMap::const_iterator mapitr= m_covtypes.begin();
+       mapitr != m_covtypes.end(); mapitr++ ) {
     string key= mapitr->first;
+    CorrelationMap::const_iterator corritr= m_corrmatrices.find( key );
+    LetterMatrixMap::const_iterator letteritr= m_lettermatrices.find( key );
+    if( corritr == m_corrmatrices.end() and 
+	letteritr == m_lettermatrices.end() ) continue;
     ost << "\n " << stripLeadingDigits( key )+":" << endl;
-    string correlations= mapitr->second;
-    vector<string> corrtokens= INIParser::getTokens( correlations );
-    string covopt= m_covopts.find( key )->second;
     ost.precision( 2 );
     ost.setf( std::ios::fixed, std::ios::floatfield );
     size_t nerr= m_names.size();
     for( size_t ierr= 0; ierr < nerr; ierr++ ) {
       for( size_t jerr= 0; jerr < nerr; jerr++ ) {
-	if( covopt.find( "m" ) != string::npos ) {
-	  ost << " " << corrtokens.at( ierr*nerr+jerr );
+	if( letteritr != m_lettermatrices.end() ) {
+	  CovarianceType letter= 
+	    CovarianceType( letteritr->second.at( ierr*nerr+jerr ) );
+	  ost << " " << letterString( letter );
 	}
-	else if( covopt.find( "c" ) != string::npos ) {
-	  Double_t corr= 
-	    INIParser::stringToType( corrtokens.at( ierr*nerr+jerr ), 0.0 );
-	  ost << " " << std::setw(5) << corr;
+	else {
+	  ost << " " << std::setw(5) << corritr->second(ierr,jerr);
 	}
       }
       ost << endl;
@@ -522,12 +1127,12 @@ void AverageDataParser::printCovariances( std::ostream& ost,
   else if( flag == std::ios_base::scientific ) {
     width= prec+7;
   }
-  for( MatrixMap::const_iterator mapitr= m_covariances.begin();
-       mapitr != m_covariances.end(); mapitr++ ) {
+  for( CovarianceMap::const_iterator mapitr= m_covsources.begin();
+       mapitr != m_covsources.end(); mapitr++ ) {
     string key= mapitr->first;
     ost << "\n " << stripLeadingDigits( key )+":" << endl;
-    TMatrixDSym covm= mapitr->second;
-    size_t nerr= covm.GetNrows();
+    const CovarianceSource& covm= mapitr->second;
+    size_t nerr= covm.getNrows();
     for( size_t ierr= 0; ierr < nerr; ierr++ ) {
       for( size_t jerr= 0; jerr < nerr; jerr++ ) {
 	ost << " " << std::setw( width ) << covm( ierr, jerr );
@@ -540,12 +1145,12 @@ void AverageDataParser::printCorrelationMatrices( std::ostream& ost )const {
   ost << "Correlation matrices:" << endl;
   ost.setf( std::ios::fixed, std::ios::floatfield );
   ost.precision( 2 );
-  for( MatrixMap::const_iterator mapitr= m_covariances.begin();
-       mapitr != m_covariances.end(); mapitr++ ) {
+  for( CovarianceMap::const_iterator mapitr= m_covsources.begin();
+       mapitr != m_covsources.end(); mapitr++ ) {
     string key= mapitr->first;
     ost << "\n " << stripLeadingDigits( key )+":" << endl;
-    TMatrixDSym covm= mapitr->second;
-    size_t nerr= covm.GetNrows();
+    const CovarianceSource& covm= mapitr->second;
+    size_t nerr= covm.getNrows();
     for( size_t ierr= 0; ierr < nerr; ierr++ ) {
       for( size_t jerr= 0; jerr < nerr; jerr++ ) {
 	Double_t corr= covm( ierr, jerr )/sqrt( covm( ierr, ierr )*covm( jerr, jerr ) );
@@ -567,10 +1172,410 @@ void AverageDataParser::printInputs( std::ostream& ost ) const {
   printValues( ost );
   printErrors( ost );
   printTotalErrors( ost );
-  if( m_correlations.size() > 0 ) {
+  if( m_corrmatrices.size()+m_lettermatrices.size() > 0 ) {
     printCorrelations( ost );
   }
   printCovariances( ost );
   printCorrelationMatrices( ost );
   return;
 }
+
+// Binary cache of the parsed state. Layout: magic, format version, 
+// FNV-1a hash and size of the source file, then the members in fixed
+// order, native byte order. Strings and vectors are written as length
+// followed by their contents. A cache is used only if magic, version, 
+// hash and size match, else the text file is parsed:
+static const char cacheMagic[8]= { 'R', 'A', 'T', 'c', 'a', 'c', 'h', 'e' };
+static const UInt_t cacheVersion= 5;
+
+// Read-only memory map of a whole file, unmapped on destruction:
+class MappedFile {
+public:
+  MappedFile( const string& fname ) : data( 0 ), size( 0 ), mapped( false ) {
+    int fd= open( fname.c_str(), O_RDONLY );
+    if( fd < 0 ) return;
+    struct stat filestat;
+    if( fstat( fd, &filestat ) == 0 ) {
+      size= filestat.st_size;
+      if( size == 0 ) {
+	mapped= true;
+      }
+      else {
+	void* addr= mmap( 0, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	if( addr != MAP_FAILED ) {
+	  data= static_cast<const char*>( addr );
+	  mapped= true;
+	}
+      }
+    }
+    close( fd );
+  }
+  ~MappedFile() {
+    if( data ) munmap( const_cast<char*>( data ), size );
+  }
+  const char* data;
+  size_t size;
+  bool mapped;
+private:
+  MappedFile( const MappedFile& );
+  MappedFile& operator=( const MappedFile& );
+};
+
+// FNV-1a 64 bit hash of a memory block:
+static ULong64_t fnv1aHash( const char* data, size_t size ) {
+  ULong64_t hash= 14695981039346656037ULL;
+  for( size_t i= 0; i < size; i++ ) {
+    hash^= static_cast<unsigned char>( data[i] );
+    hash*= 1099511628211ULL;
+  }
+  return hash;
+}
+
+class CacheError: public std::exception {
+public:
+  virtual const char* what() const throw() {
+    return "AverageDataParser cache corrupt";
+  }
+};
+
+// Append plain data to a buffer:
+class CacheWriter {
+public:
+  void write( const void* data, size_t nbytes ) {
+    buffer.append( static_cast<const char*>( data ), nbytes );
+  }
+  void write( UInt_t value ) { write( &value, sizeof(value) ); }
+  void write( ULong64_t value ) { write( &value, sizeof(value) ); }
+  void write( Double_t value ) { write( &value, sizeof(value) ); }
+  void write( const string& str ) {
+    write( UInt_t( str.size() ) );
+    write( str.data(), str.size() );
+  }
+  void write( const vector<string>& strings ) {
+    write( UInt_t( strings.size() ) );
+    for( size_t istr= 0; istr < strings.size(); istr++ ) {
+      write( strings[istr] );
+    }
+  }
+  void write( const TVectorD& vec ) {
+    write( UInt_t( vec.GetNoElements() ) );
+    write( vec.GetMatrixArray(), vec.GetNoElements()*sizeof(Double_t) );
+  }
+  void write( const TMatrixDBase& matrix ) {
+    write( UInt_t( matrix.GetNrows() ) );
+    write( UInt_t( matrix.GetNcols() ) );
+    write( matrix.GetMatrixArray(), 
+	   matrix.GetNrows()*matrix.GetNcols()*sizeof(Double_t) );
+  }
+  void write( const CovarianceSource& source ) {
+    write( UInt_t( source.getNrows() ) );
+    write( UInt_t( source.isDense() ) );
+    if( source.isDense() ) {
+      write( source.getDenseMatrix() );
+    }
+    else {
+      write( source.getDiagonal() );
+      write( source.getVector() );
+      write( source.getSign() );
+    }
+  }
+  string buffer;
+};
+
+// Read plain data from a memory block with bounds checks:
+class CacheReader {
+public:
+  CacheReader( const char* data, size_t size ) : 
+    m_data( data ), m_size( size ), m_pos( 0 ) {}
+  void read( void* dest, size_t nbytes ) {
+    if( nbytes > m_size-m_pos ) throw CacheError();
+    if( nbytes > 0 ) memcpy( dest, m_data+m_pos, nbytes );
+    m_pos+= nbytes;
+  }
+  UInt_t readUInt() { UInt_t value; read( &value, sizeof(value) ); return value; }
+  ULong64_t readULong64() { 
+    ULong64_t value; 
+    read( &value, sizeof(value) ); 
+    return value; 
+  }
+  Double_t readDouble() { 
+    Double_t value; 
+    read( &value, sizeof(value) ); 
+    return value; 
+  }
+  string readString() {
+    UInt_t nchar= readUInt();
+    if( nchar > m_size-m_pos ) throw CacheError();
+    string str( m_data+m_pos, nchar );
+    m_pos+= nchar;
+    return str;
+  }
+  vector<string> readStrings() {
+    UInt_t nstr= readUInt();
+    vector<string> strings;
+    for( UInt_t istr= 0; istr < nstr; istr++ ) {
+      strings.push_back( readString() );
+    }
+    return strings;
+  }
+  // Sizes from the cache are checked against the remaining bytes before
+  // anything is allocated:
+  void checkDoubles( size_t nelem ) const {
+    if( nelem > remaining()/sizeof(Double_t) ) throw CacheError();
+  }
+  void checkShape( const TMatrixD&, UInt_t, UInt_t ) const {}
+  void checkShape( const TMatrixDSym&, UInt_t nrows, UInt_t ncols ) const {
+    if( nrows != ncols ) throw CacheError();
+  }
+  void readVector( TVectorD& vec ) {
+    UInt_t nelem= readUInt();
+    checkDoubles( nelem );
+    vec.ResizeTo( nelem );
+    read( vec.GetMatrixArray(), nelem*sizeof(Double_t) );
+  }
+  template <class Matrix> void readMatrix( Matrix& matrix ) {
+    UInt_t nrows= readUInt();
+    UInt_t ncols= readUInt();
+    checkShape( matrix, nrows, ncols );
+    if( ncols > 0 and nrows > size_t( -1 )/ncols ) throw CacheError();
+    checkDoubles( size_t( nrows )*ncols );
+    matrix.ResizeTo( nrows, ncols );
+    read( matrix.GetMatrixArray(), size_t( nrows )*ncols*sizeof(Double_t) );
+  }
+  CovarianceSource readSource() {
+    UInt_t ndim= readUInt();
+    bool dense= readUInt();
+    if( dense ) {
+      TMatrixDSym matrix;
+      readMatrix( matrix );
+      return CovarianceSource( matrix );
+    }
+    TVectorD diagonal;
+    readVector( diagonal );
+    TVectorD vec;
+    readVector( vec );
+    Double_t sign= readDouble();
+    if( UInt_t( diagonal.GetNoElements() ) != ndim ) throw CacheError();
+    if( vec.GetNoElements() == 0 ) return CovarianceSource( diagonal );
+    return CovarianceSource( diagonal, vec, sign );
+  }
+  bool atEnd() const { return m_pos == m_size; }
+  size_t remaining() const { return m_size-m_pos; }
+private:
+  const char* m_data;
+  size_t m_size;
+  size_t m_pos;
+};
+
+void AverageDataParser::writeCache( const string& cachename ) const {
+  MappedFile source( m_filename );
+  if( not source.mapped ) {
+    std::cerr << "AverageDataParser: cannot hash " << m_filename 
+	      << ", cache not written" << endl;
+    return;
+  }
+  CacheWriter writer;
+  writer.write( cacheMagic, sizeof(cacheMagic) );
+  writer.write( cacheVersion );
+  writer.write( fnv1aHash( source.data, source.size ) );
+  writer.write( ULong64_t( source.size ) );
+  writer.write( m_names );
+  writer.write( m_values );
+  writer.write( UInt_t( m_errors.size() ) );
+  for( VectorMap::const_iterator mapitr= m_errors.begin();
+       mapitr != m_errors.end(); mapitr++ ) {
+    writer.write( mapitr->first );
+    writer.write( mapitr->second );
+    writer.write( m_covopts.find( mapitr->first )->second );
+  }
+  writer.write( UInt_t( m_corrmatrices.size() ) );
+  for( CorrelationMap::const_iterator mapitr= m_corrmatrices.begin();
+       mapitr != m_corrmatrices.end(); mapitr++ ) {
+    writer.write( mapitr->first );
+    writer.write( mapitr->second );
+  }
+  writer.write( UInt_t( m_lettermatrices.size() ) );
+  for( LetterMatrixMap::const_iterator mapitr= m_lettermatrices.begin();
+       mapitr != m_lettermatrices.end(); mapitr++ ) {
+    writer.write( mapitr->first );
+    writer.write( UInt_t( mapitr->second.size() ) );
+    if( mapitr->second.size() > 0 ) {
+      writer.write( &mapitr->second[0], mapitr->second.size() );
+    }
+  }
+  writer.write( m_groups );
+  writer.write( m_uniquegroups );
+  writer.write( UInt_t( m_groupmap.getNgroups() ) );
+  writer.write( UInt_t( m_groupmap.getNvar() ) );
+  if( m_groupmap.getNvar() > 0 ) {
+    writer.write( &m_groupmap.getIndices()[0], 
+		  m_groupmap.getNvar()*sizeof(Int_t) );
+  }
+  writer.write( UInt_t( m_covsources.size() ) );
+  for( CovarianceMap::const_iterator mapitr= m_covsources.begin();
+       mapitr != m_covsources.end(); mapitr++ ) {
+    writer.write( mapitr->first );
+    writer.write( mapitr->second );
+    writer.write( m_reducedcovsources.find( mapitr->first )->second );
+  }
+  writer.write( UInt_t( m_systerrors.size() ) );
+  for( VectorMap::const_iterator mapitr= m_systerrors.begin();
+       mapitr != m_systerrors.end(); mapitr++ ) {
+    writer.write( mapitr->first );
+    writer.write( mapitr->second );
+  }
+  writer.write( m_totalerrors );
+  // Write to a temporary and rename so readers never see a partial file:
+  string tmpname= cachename + ".tmp";
+  std::ofstream cachefile( tmpname.c_str(), 
+			   std::ios::binary | std::ios::trunc );
+  cachefile.write( writer.buffer.data(), writer.buffer.size() );
+  cachefile.close();
+  if( not cachefile or rename( tmpname.c_str(), cachename.c_str() ) != 0 ) {
+    std::cerr << "AverageDataParser: cannot write cache " << cachename 
+	      << endl;
+    remove( tmpname.c_str() );
+  }
+  return;
+}
+
+bool AverageDataParser::readCache( const string& cachename ) {
+  MappedFile cache( cachename );
+  if( not cache.mapped or cache.size == 0 ) return false;
+  MappedFile source( m_filename );
+  if( not source.mapped ) return false;
+  try {
+    CacheReader reader( cache.data, cache.size );
+    char magic[sizeof(cacheMagic)];
+    reader.read( magic, sizeof(magic) );
+    if( memcmp( magic, cacheMagic, sizeof(magic) ) != 0 or
+	reader.readUInt() != cacheVersion or
+	reader.readULong64() != fnv1aHash( source.data, source.size ) or
+	reader.readULong64() != source.size ) {
+      return false;
+    }
+    m_names= reader.readStrings();
+    reader.readVector( m_values );
+    UInt_t nerrors= reader.readUInt();
+    for( UInt_t ierr= 0; ierr < nerrors; ierr++ ) {
+      string errorkey= reader.readString();
+      reader.readVector( m_errors[errorkey] );
+      m_covopts[errorkey]= reader.readString();
+    }
+    makeCovoptionTypes();
+    UInt_t ncorr= reader.readUInt();
+    for( UInt_t icorr= 0; icorr < ncorr; icorr++ ) {
+      string errorkey= reader.readString();
+      reader.readMatrix( m_corrmatrices[errorkey] );
+      m_filecorrelations.insert( errorkey );
+    }
+    UInt_t nletter= reader.readUInt();
+    for( UInt_t iletter= 0; iletter < nletter; iletter++ ) {
+      string errorkey= reader.readString();
+      LetterMatrix& letters= m_lettermatrices[errorkey];
+      m_filecorrelations.insert( errorkey );
+      UInt_t nletters= reader.readUInt();
+      if( nletters > reader.remaining() ) throw CacheError();
+      letters.resize( nletters );
+      if( letters.size() > 0 ) reader.read( &letters[0], letters.size() );
+    }
+    m_groups= reader.readStrings();
+    m_uniquegroups= reader.readStrings();
+    UInt_t ngroups= reader.readUInt();
+    UInt_t nindices= reader.readUInt();
+    if( nindices > reader.remaining()/sizeof(Int_t) ) throw CacheError();
+    vector<Int_t> indices( nindices );
+    if( indices.size() > 0 ) {
+      reader.read( &indices[0], indices.size()*sizeof(Int_t) );
+    }
+    for( size_t ivar= 0; ivar < indices.size(); ivar++ ) {
+      if( indices[ivar] < 0 or UInt_t( indices[ivar] ) >= ngroups ) {
+	throw CacheError();
+      }
+    }
+    m_groupmap= GroupMap( ngroups, indices );
+    UInt_t nsources= reader.readUInt();
+    for( UInt_t isrc= 0; isrc < nsources; isrc++ ) {
+      string errorkey= reader.readString();
+      m_covsources.insert( CovarianceMap::value_type( errorkey, 
+						      reader.readSource() ) );
+      m_reducedcovsources.insert( CovarianceMap::value_type( errorkey, 
+							     reader.readSource() ) );
+    }
+    UInt_t nsyst= reader.readUInt();
+    for( UInt_t isyst= 0; isyst < nsyst; isyst++ ) {
+      string errorkey= reader.readString();
+      reader.readVector( m_systerrors[errorkey] );
+    }
+    makeSysterrorMatrix();
+    reader.readVector( m_totalerrors );
+    if( not reader.atEnd() or not checkCacheSizes() ) throw CacheError();
+  }
+  catch( const CacheError& ) {
+    clear();
+    return false;
+  }
+  return true;
+}
+
+// All members loaded from the cache have one entry per measurement:
+bool AverageDataParser::checkCacheSizes() const {
+  Int_t nvar= m_names.size();
+  if( m_values.GetNoElements() != nvar or 
+      m_totalerrors.GetNoElements() != nvar or
+      m_groups.size() != m_names.size() or 
+      m_groupmap.getNvar() != nvar ) return false;
+  for( VectorMap::const_iterator mapitr= m_errors.begin();
+       mapitr != m_errors.end(); mapitr++ ) {
+    if( mapitr->second.GetNoElements() != nvar ) return false;
+  }
+  for( VectorMap::const_iterator mapitr= m_systerrors.begin();
+       mapitr != m_systerrors.end(); mapitr++ ) {
+    if( mapitr->second.GetNoElements() != nvar ) return false;
+  }
+  for( CorrelationMap::const_iterator mapitr= m_corrmatrices.begin();
+       mapitr != m_corrmatrices.end(); mapitr++ ) {
+    if( mapitr->second.GetNrows() != nvar or 
+	mapitr->second.GetNcols() != nvar ) return false;
+  }
+  for( LetterMatrixMap::const_iterator mapitr= m_lettermatrices.begin();
+       mapitr != m_lettermatrices.end(); mapitr++ ) {
+    if( mapitr->second.size() != size_t( nvar )*size_t( nvar ) ) {
+      return false;
+    }
+  }
+  for( CovarianceMap::const_iterator mapitr= m_covsources.begin();
+       mapitr != m_covsources.end(); mapitr++ ) {
+    if( mapitr->second.getNrows() != nvar ) return false;
+  }
+  for( CovarianceMap::const_iterator mapitr= m_reducedcovsources.begin();
+       mapitr != m_reducedcovsources.end(); mapitr++ ) {
+    if( mapitr->second.getNrows() != nvar ) return false;
+  }
+  return true;
+}
+
+// Reset to the empty state after a failed cache read:
+void AverageDataParser::clear() {
+  m_names.clear();
+  m_values.ResizeTo( 0 );
+  m_errors.clear();
+  m_covopts.clear();
+  m_covtypes.clear();
+  m_corrmatrices.clear();
+  m_lettermatrices.clear();
+  m_correlations.clear();
+  m_filecorrelations.clear();
+  m_groups.clear();
+  m_uniquegroups.clear();
+  m_covsources.clear();
+  m_reducedcovsources.clear();
+  m_covariances.clear();
+  m_reducedCovariances.clear();
+  m_systerrors.clear();
+  m_systerrmatrix.clear();
+  m_groupmap= GroupMap();
+  m_groupmatrix.ResizeTo( 0, 0 );
+  m_totalerrors.ResizeTo( 0 );
+  return;
+}
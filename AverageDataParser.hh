@@ -4,12 +4,16 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
 #include <iostream>
 
 #include "TVectorD.h"
 #include "TMatrixD.h"
 #include "TMatrixDSym.h"
 
+#include "CovarianceSource.hh"
+#include "GroupMap.hh"
+
 namespace INIParser {
   class INIReader;
 }
@@ -17,12 +21,35 @@ namespace INIParser {
 typedef std::map<std::string,TMatrixDSym> MatrixMap;
 typedef std::map<std::string,TVectorD> VectorMap;
 typedef std::map<std::string,std::string> StringMap;
+typedef std::map<std::string,Double_t> ValueMap;
+
+// Covariance options parsed once per error source, the letters of
+// option m matrices use the types u, p, f and a:
+enum CovarianceType { kUnknown, kUncorrelated, kPartial, kFull, kAnti, 
+		      kGlobalPartial, kGlobalPartialRelative, 
+		      kCorrelationMatrix, kLetterMatrix };
+struct covoption_t {
+  CovarianceType type;
+  bool relative;
+};
+typedef std::map<std::string,covoption_t> CovoptionMap;
+typedef std::vector<unsigned char> LetterMatrix;
+typedef std::map<std::string,LetterMatrix> LetterMatrixMap;
+typedef std::map<std::string,TMatrixD> CorrelationMap;
 
+// Getters return const references to the parsed inputs, copy them only
+// where ownership is needed; sums are calculated and returned by value.
+// Covariances are kept per error source in compact form, the dense
+// matrices from getCovariances are made on first use:
 class AverageDataParser {
 
 public:
 
   AverageDataParser( const std::string& fname );
+  AverageDataParser( const std::string& fname, 
+		     const std::string& cachename );
+  AverageDataParser( const INIParser::INIReader& reader,
+		     const std::string& fname, const std::string& suffix );
   AverageDataParser( const std::vector<std::string>& names,
 		     const TVectorD& values,
 		     const VectorMap& errors,
@@ -31,20 +58,26 @@ public:
 		     std::vector<std::string> groups= 
 		     std::vector<std::string>() );
 
-  std::vector<std::string> getNames() const;
-  TVectorD getValues() const;
-  VectorMap getErrors() const;
-  StringMap getCovoption() const;
-  StringMap getCorrelations() const;
-  TVectorD getTotalErrors() const;
-  MatrixMap getCovariances() const;
-  MatrixMap getReducedCovariances() const;
+  const std::vector<std::string>& getNames() const;
+  const TVectorD& getValues() const;
+  const VectorMap& getErrors() const;
+  const StringMap& getCovoption() const;
+  const CovoptionMap& getCovoptionTypes() const;
+  const StringMap& getCorrelations() const;
+  const CorrelationMap& getCorrelationMatrices() const;
+  const LetterMatrixMap& getLetterMatrices() const;
+  const TVectorD& getTotalErrors() const;
+  const CovarianceMap& getCovarianceSources() const;
+  const CovarianceMap& getReducedCovarianceSources() const;
+  const MatrixMap& getCovariances() const;
+  const MatrixMap& getReducedCovariances() const;
   TMatrixDSym getTotalCovariances() const;
   TMatrixDSym getTotalReducedCovariances() const;
-  std::map<int,TVectorD> getSysterrorMatrix() const;
-  std::vector<std::string> getGroups() const;
-  std::vector<std::string> getUniqueGroups() const;
-  TMatrixD getGroupMatrix() const;
+  const std::map<int,TVectorD>& getSysterrorMatrix() const;
+  const std::vector<std::string>& getGroups() const;
+  const std::vector<std::string>& getUniqueGroups() const;
+  const GroupMap& getGroupMap() const;
+  const TMatrixD& getGroupMatrix() const;
   void printInputs( std::ostream& ost=std::cout ) const;
   void printFilename( std::ostream& ost=std::cout ) const;
   void printNames( std::ostream& ost=std::cout ) const;
@@ -59,39 +92,95 @@ public:
 			 size_t prec=4 ) const;
   void printCorrelationMatrices( std::ostream& ost=std::cout ) const;
   std::string stripLeadingDigits( const std::string& word ) const;
+  void setValue( Int_t ivar, Double_t value );
+  void setError( const std::string& errorkey, Int_t ivar, Double_t error );
+  void addErrorSource( const std::string& errorkey, const TVectorD& errors,
+		       const std::string& covopt, 
+		       const std::string& correlations= "" );
+  void removeErrorSource( const std::string& errorkey );
+  void setCorrelation( const std::string& errorkey, Int_t ivar, Int_t jvar,
+		       Double_t correlation );
+  void addMeasurement( const std::string& name, Double_t value,
+		       const ValueMap& errors,
+		       const StringMap& correlations= StringMap(),
+		       const std::string& group= "a" );
+  void removeMeasurement( Int_t ivar );
 
 private:
 
+  void parseFile( const std::string& fname );
+  void parseReader( const INIParser::INIReader& reader );
+  bool readCache( const std::string& cachename );
+  // Only from the file parsing constructor, the cache is keyed by the
+  // hash of the whole file:
+  void writeCache( const std::string& cachename ) const;
+  bool checkCacheSizes() const;
+  void clear();
   void makeNames( const INIParser::INIReader& );
   void makeValues( const INIParser::INIReader& );
   void makeGroups( const INIParser::INIReader& );
-  void makeGroupMatrix();
+  void makeGroupMap();
   void makeErrorsAndOptions( const INIParser::INIReader& );
+  void makeCovoptionTypes();
+  void storeCorrelations( const std::string& errorkey,
+			  const std::vector<std::string>& tokens );
+  void parseCorrelations( const std::string& errorkey, CovarianceType type,
+			  const std::vector<std::string>& tokens,
+			  TMatrixD& corrmatrix, LetterMatrix& letters ) const;
+  void storeCorrelations( const std::string& errorkey, CovarianceType type,
+			  TMatrixD& corrmatrix, LetterMatrix& letters );
+  void makeCorrelationStrings() const;
+  void readCorrelationStrings() const;
   void checkRelativeErrors();
   void makeCorrelations( const INIParser::INIReader& );
   void makeCovariances();
+  void makeCovariance( const std::string& errorkey );
+  void buildCovariance( const std::string& errorkey, CovarianceType type,
+			const TVectorD& errors, const TMatrixD* corrmatrix,
+			const LetterMatrix* letters, CovarianceSource& covm,
+			CovarianceSource& reducedcovm, 
+			TVectorD& systerrs ) const;
+  void storeCovariance( const std::string& errorkey,
+			const CovarianceSource& covm,
+			const CovarianceSource& reducedcovm,
+			const TVectorD& systerrs );
+  void makeSysterrorMatrix();
+  void remakeMeasurements();
+  void checkIndex( Int_t ivar ) const;
+  VectorMap::iterator findErrors( const std::string& errorkey );
   void makeTotalErrors();
   void initialise();
-  Double_t calcCovariance( const std::string& covopt, 
-			   const TVectorD& errors, 
-			   size_t ierr, size_t jerr ) const;
-  TMatrixDSym sumOverMatrixMap( const MatrixMap& ) const;
+  Double_t calcCovariance( CovarianceType type, const TVectorD& errors, 
+			   Int_t ierr, Int_t jerr ) const;
+  TMatrixDSym sumOverCovarianceMap( const CovarianceMap& ) const;
+  void makeMatrixMap( const CovarianceMap&, MatrixMap& ) const;
   void printvectorstring( const std::vector<std::string>& vec,
 			  const std::string& txt,
 			  std::ostream& ost=std::cout ) const;
 
   std::string m_filename;
+  std::string m_datasection;
+  std::string m_covsection;
   std::vector<std::string> m_names;
   TVectorD m_values;
   VectorMap m_errors;
   StringMap m_covopts;
-  StringMap m_correlations;
+  CovoptionMap m_covtypes;
+  CorrelationMap m_corrmatrices;
+  LetterMatrixMap m_lettermatrices;
+  mutable StringMap m_correlations;
+  // Sources with option c or m unchanged since read from m_filename:
+  std::set<std::string> m_filecorrelations;
   std::vector<std::string> m_groups;
   std::vector<std::string> m_uniquegroups;
-  MatrixMap m_covariances;
-  MatrixMap m_reducedCovariances;
+  CovarianceMap m_covsources;
+  CovarianceMap m_reducedcovsources;
+  mutable MatrixMap m_covariances;
+  mutable MatrixMap m_reducedCovariances;
+  VectorMap m_systerrors;
   std::map<int,TVectorD> m_systerrmatrix;
-  TMatrixD m_groupmatrix;
+  GroupMap m_groupmap;
+  mutable TMatrixD m_groupmatrix;
   TVectorD m_totalerrors;
 
 };
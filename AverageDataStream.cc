@@ -0,0 +1,66 @@
+
+#include "AverageDataStream.hh"
+#include "INIReader.hh"
+
+#include <sstream>
+#include <exception>
+
+using std::string;
+
+// Errors from AverageDataStream:
+class StreamError: public std::exception {
+public:
+  StreamError( const string& txt ) : 
+    message( "AverageDataStream error: " + txt ) {}
+  virtual ~StreamError() throw() {}
+  virtual const char* what() const throw() {
+    return message.c_str();
+  }
+private:
+  string message;
+};
+
+// Read the file and find the data sets, numbering stops at the first
+// missing [Data<n>] section:
+AverageDataStream::AverageDataStream( const string& fname ) :
+  m_filename( fname ), m_reader( new INIParser::INIReader( fname ) ), 
+  m_next( 0 ) {
+  if( m_reader->parseError() != 0 ) {
+    std::stringstream strstr;
+    strstr << "parse error " << m_reader->parseError() << " in " << fname;
+    delete m_reader;
+    throw StreamError( strstr.str() );
+  }
+  if( not m_reader->getNames( "Data" ).empty() ) m_suffixes.push_back( "" );
+  for( size_t iset= 1; ; iset++ ) {
+    std::stringstream strstr;
+    strstr << iset;
+    if( m_reader->getNames( "Data"+strstr.str() ).empty() ) break;
+    m_suffixes.push_back( strstr.str() );
+  }
+}
+
+AverageDataStream::~AverageDataStream() {
+  delete m_reader;
+}
+
+// Number of data sets:
+size_t AverageDataStream::size() const {
+  return m_suffixes.size();
+}
+
+bool AverageDataStream::hasNext() const {
+  return m_next < m_suffixes.size();
+}
+
+// Parser for the next data set:
+AverageDataParser AverageDataStream::next() {
+  if( not hasNext() ) throw StreamError( "no more data sets in " + 
+					 m_filename );
+  return AverageDataParser( *m_reader, m_filename, m_suffixes[m_next++] );
+}
+
+void AverageDataStream::rewind() {
+  m_next= 0;
+  return;
+}
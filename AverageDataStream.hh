@@ -0,0 +1,37 @@
+#ifndef AVERAGEDATASTREAM_HH
+#define AVERAGEDATASTREAM_HH
+
+#include <string>
+#include <vector>
+
+#include "AverageDataParser.hh"
+
+// Input file with several data sets in numbered sections [Data1], 
+// [Covariances1], [Data2], [Covariances2], ... An unnumbered [Data] 
+// section counts as the first data set. The file is read once, the 
+// parser of each data set is made only when next() reaches it:
+class AverageDataStream {
+
+public:
+
+  AverageDataStream( const std::string& fname );
+  ~AverageDataStream();
+
+  size_t size() const;
+  bool hasNext() const;
+  AverageDataParser next();
+  void rewind();
+
+private:
+
+  AverageDataStream( const AverageDataStream& );
+  AverageDataStream& operator=( const AverageDataStream& );
+
+  std::string m_filename;
+  INIParser::INIReader* m_reader;
+  std::vector<std::string> m_suffixes;
+  size_t m_next;
+
+};
+
+#endif
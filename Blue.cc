@@ -6,103 +6,1240 @@
  */
 
 #include "Blue.hh"
+#include "Parallel.hh"
+#include "LinearAlgebra.hh"
 
 #include <iostream>
 #include <iomanip>
+#include <sstream>
+#include <exception>
+#include <set>
+#include <algorithm>
 
 #include "TMath.h"
 
 using std::string;
 using std::vector;
 
+// Errors from Blue:
+class BlueError: public std::exception {
+public:
+  BlueError( const string& txt ) : message( "Blue error: " + txt ) {}
+  virtual ~BlueError() throw() {}
+  virtual const char* what() const throw() {
+    return message.c_str();
+  }
+private:
+  string message;
+};
+
+// The total covariance matrix is factorised once and the factorisation
+// is reused for weights and chi^2, no explicit inverse.
+// The factorisation is done here to reject bad inputs early, all results
+// are calculated on first access and cached:
 Blue::Blue( const string& filename ) :
-  m_parser( filename ), 
-  m_invm( m_parser.getTotalCovariances() ) {
-  m_invm.Invert();
-  calcWeightsMatrix();
-  calcAverage();
-  calcChisq();
-  calcPulls();
-  errorAnalysis();
+  m_parser( filename ), m_valid( 0 ), m_method( kDenseCholesky ) {
+  factorise();
+}
+Blue::Blue( const AverageDataParser& parser ) :
+  m_parser( parser ), m_valid( 0 ), m_method( kDenseCholesky ) {
+  factorise();
 }
 
 Blue::~Blue() {}
 
-TMatrixD Blue::getWeightsMatrix() const {
+// Invalidate cached results and everything calculated from them:
+void Blue::invalidate( unsigned results ) const {
+  if( results & kFactor ) results|= kCholesky | kWeights | kChisq;
+  if( results & kWeights ) results|= kAverage | kErrors;
+  if( results & kAverage ) results|= kChisq | kPulls;
+  m_valid&= ~results;
+  return;
+}
+
+// Dense factor U of V= U^T U from the linear algebra backend, also kept
+// up to date by measurement appends and removals:
+const TMatrixD& Blue::getDenseFactor() const {
+  if( not ( m_valid & kCholesky ) ) {
+    if( not getLinearAlgebra().cholesky( m_parser.getTotalCovariances(),
+					 m_upper ) ) {
+      throw BlueError( "total covariance matrix not positive definite" );
+    }
+    m_valid|= kCholesky;
+  }
+  return m_upper;
+}
+
+// Measurements are connected if any error source correlates them, the
+// connected components are the diagonal blocks of V. Union-find over
+// the nonzero off-diagonal elements of dense sources and the nonzero
+// entries of rank-one terms:
+static Int_t findRoot( vector<Int_t>& parents, Int_t ivar ) {
+  while( parents[ivar] != ivar ) {
+    parents[ivar]= parents[parents[ivar]];
+    ivar= parents[ivar];
+  }
+  return ivar;
+}
+static void joinBlocks( vector<Int_t>& parents, Int_t ivar, Int_t jvar ) {
+  Int_t iroot= findRoot( parents, ivar );
+  Int_t jroot= findRoot( parents, jvar );
+  if( iroot != jroot ) parents[std::max( iroot, jroot )]= 
+			 std::min( iroot, jroot );
+  return;
+}
+static vector< vector<Int_t> > findBlocks( const CovarianceMap& sources,
+					   Int_t nvar ) {
+  vector<Int_t> parents( nvar );
+  for( Int_t ivar= 0; ivar < nvar; ivar++ ) parents[ivar]= ivar;
+  for( CovarianceMap::const_iterator mapitr= sources.begin();
+       mapitr != sources.end(); mapitr++ ) {
+    const CovarianceSource& source= mapitr->second;
+    if( source.isDense() ) {
+      const TMatrixDSym& matrix= source.getDenseMatrix();
+      for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+	for( Int_t jvar= ivar+1; jvar < nvar; jvar++ ) {
+	  if( matrix(ivar,jvar) != 0.0 ) joinBlocks( parents, ivar, jvar );
+	}
+      }
+    }
+    else if( source.hasRankOne() ) {
+      const TVectorD& vec= source.getVector();
+      Int_t first= -1;
+      for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+	if( vec[ivar] == 0.0 ) continue;
+	if( first < 0 ) first= ivar;
+	else joinBlocks( parents, first, ivar );
+      }
+    }
+  }
+  vector< vector<Int_t> > blocks;
+  vector<Int_t> blockindex( nvar, -1 );
+  for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+    Int_t root= findRoot( parents, ivar );
+    if( blockindex[root] < 0 ) {
+      blockindex[root]= blocks.size();
+      blocks.push_back( vector<Int_t>() );
+    }
+    blocks[blockindex[root]].push_back( ivar );
+  }
+  return blocks;
+}
+
+// Blocks are factorised and solved in parallel for larger inputs only,
+// small ones are not worth starting threads:
+static const Int_t minParallelSize= 200;
+
+class BlockFactorTask: public ParallelTask {
+public:
+  BlockFactorTask( const TMatrixDSym& totalcov, 
+		   const vector< vector<Int_t> >& blocks,
+		   vector<TDecompChol>& chols ) :
+    m_totalcov( totalcov ), m_blocks( blocks ), m_chols( chols ) {}
+  void operator()( size_t iblock, unsigned ) {
+    const vector<Int_t>& indices= m_blocks[iblock];
+    Int_t nblock= indices.size();
+    TMatrixDSym blockcov( nblock );
+    for( Int_t i= 0; i < nblock; i++ ) {
+      for( Int_t j= 0; j < nblock; j++ ) {
+	blockcov(i,j)= m_totalcov(indices[i],indices[j]);
+      }
+    }
+    m_chols[iblock]= TDecompChol( blockcov );
+    if( not m_chols[iblock].Decompose() ) {
+      throw BlueError( "total covariance matrix not positive definite" );
+    }
+  }
+private:
+  const TMatrixDSym& m_totalcov;
+  const vector< vector<Int_t> >& m_blocks;
+  vector<TDecompChol>& m_chols;
+};
+
+class BlockSolveTask: public ParallelTask {
+public:
+  BlockSolveTask( const vector< vector<Int_t> >& blocks,
+		  vector<TDecompChol>& chols, TMatrixD& bmatrix ) :
+    m_blocks( blocks ), m_chols( chols ), m_bmatrix( bmatrix ) {}
+  void operator()( size_t iblock, unsigned ) {
+    const vector<Int_t>& indices= m_blocks[iblock];
+    Int_t nblock= indices.size();
+    Int_t ncols= m_bmatrix.GetNcols();
+    TMatrixD bblock( nblock, ncols );
+    for( Int_t i= 0; i < nblock; i++ ) {
+      for( Int_t icol= 0; icol < ncols; icol++ ) {
+	bblock(i,icol)= m_bmatrix(indices[i],icol);
+      }
+    }
+    m_chols[iblock].MultiSolve( bblock );
+    for( Int_t i= 0; i < nblock; i++ ) {
+      for( Int_t icol= 0; icol < ncols; icol++ ) {
+	m_bmatrix(indices[i],icol)= bblock(i,icol);
+      }
+    }
+  }
+private:
+  const vector< vector<Int_t> >& m_blocks;
+  vector<TDecompChol>& m_chols;
+  TMatrixD& m_bmatrix;
+};
+
+// V is factorised per diagonal block if it has more than one, else with
+// the Woodbury setup if possible, else by one Cholesky decomposition:
+void Blue::factorise() const {
+  Int_t nvar= m_parser.getValues().GetNoElements();
+  m_blocks= findBlocks( m_parser.getCovarianceSources(), nvar );
+  if( m_blocks.size() > 1 ) {
+    TMatrixDSym totalcov= m_parser.getTotalCovariances();
+    m_blockchols.assign( m_blocks.size(), TDecompChol() );
+    BlockFactorTask task( totalcov, m_blocks, m_blockchols );
+    parallelFor( m_blocks.size(), task, 
+		 nvar >= minParallelSize ? 0 : 1 );
+    m_method= kBlockCholesky;
+  }
+  else if( factoriseWoodbury() ) {
+    m_method= kWoodbury;
+  }
+  else {
+    m_method= kDenseCholesky;
+    getDenseFactor();
+  }
+  m_valid|= kFactor;
+  return;
+}
+
+// When all error sources are diagonal plus positive rank-one terms, 
+// V= D + R R^T with R the N x k matrix of the rank-one vectors, and 
+// V^-1 B= D^-1 B - D^-1 R (1 + R^T D^-1 R)^-1 R^T D^-1 B (Woodbury) 
+// costs O(N k) per column instead of O(N^2) after an O(N k^2) setup.
+// Not possible if D has zeros:
+bool Blue::factoriseWoodbury() const {
+  const CovarianceMap& sources= m_parser.getCovarianceSources();
+  Int_t nvar= m_parser.getValues().GetNoElements();
+  vector<const TVectorD*> vectors;
+  for( CovarianceMap::const_iterator mapitr= sources.begin();
+       mapitr != sources.end(); mapitr++ ) {
+    const CovarianceSource& source= mapitr->second;
+    if( source.isDense() or 
+	( source.hasRankOne() and source.getSign() < 0.0 ) ) {
+      return false;
+    }
+    if( source.hasRankOne() ) vectors.push_back( &source.getVector() );
+  }
+  Int_t nrank= vectors.size();
+  if( nrank >= nvar ) return false;
+  m_diaginv.ResizeTo( nvar );
+  m_diaginv.Zero();
+  for( CovarianceMap::const_iterator mapitr= sources.begin();
+       mapitr != sources.end(); mapitr++ ) {
+    m_diaginv+= mapitr->second.getDiagonal();
+  }
+  for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+    if( not ( m_diaginv[ivar] > 0.0 ) ) return false;
+    m_diaginv[ivar]= 1.0/m_diaginv[ivar];
+  }
+  m_lowrank.ResizeTo( nvar, nrank );
+  m_dinvlowrank.ResizeTo( nvar, nrank );
+  if( nrank > 0 ) {
+    for( Int_t irank= 0; irank < nrank; irank++ ) {
+      for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+	m_lowrank(ivar,irank)= (*vectors[irank])[ivar];
+	m_dinvlowrank(ivar,irank)= m_diaginv[ivar]*m_lowrank(ivar,irank);
+      }
+    }
+    TMatrixD rtdinvr( m_lowrank, TMatrixD::kTransposeMult, m_dinvlowrank );
+    TMatrixDSym capacitance( nrank );
+    for( Int_t irank= 0; irank < nrank; irank++ ) {
+      for( Int_t jrank= 0; jrank < nrank; jrank++ ) {
+	capacitance(irank,jrank)= rtdinvr(irank,jrank);
+      }
+      capacitance(irank,irank)+= 1.0;
+    }
+    m_capacitance= TDecompChol( capacitance );
+    if( not m_capacitance.Decompose() ) return false;
+  }
+  return true;
+}
+
+// Substitution U^T x= b with the upper triangular factor of V= U^T U,
+// O(N^2):
+static void solveTransposed( const TMatrixD& upper, TVectorD& bvector ) {
+  Int_t nvar= upper.GetNrows();
+  for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+    Double_t sum= bvector[ivar];
+    for( Int_t jvar= 0; jvar < ivar; jvar++ ) {
+      sum-= upper(jvar,ivar)*bvector[jvar];
+    }
+    bvector[ivar]= sum/upper(ivar,ivar);
+  }
+  return;
+}
+
+// Replace the columns of b by V^-1 b:
+void Blue::solve( TMatrixD& bmatrix ) const {
+  if( not ( m_valid & kFactor ) ) factorise();
+  if( m_method == kDenseCholesky ) {
+    getLinearAlgebra().choleskySolve( getDenseFactor(), bmatrix );
+  }
+  else if( m_method == kBlockCholesky ) {
+    BlockSolveTask task( m_blocks, m_blockchols, bmatrix );
+    parallelFor( m_blocks.size(), task, 
+		 bmatrix.GetNrows() >= minParallelSize ? 0 : 1 );
+  }
+  else {
+    for( Int_t ivar= 0; ivar < bmatrix.GetNrows(); ivar++ ) {
+      for( Int_t icol= 0; icol < bmatrix.GetNcols(); icol++ ) {
+	bmatrix(ivar,icol)*= m_diaginv[ivar];
+      }
+    }
+    if( m_lowrank.GetNcols() > 0 ) {
+      TMatrixD rtdinvb( m_lowrank, TMatrixD::kTransposeMult, bmatrix );
+      m_capacitance.MultiSolve( rtdinvb );
+      TMatrixD correction( bmatrix.GetNrows(), bmatrix.GetNcols() );
+      getLinearAlgebra().multiply( m_dinvlowrank, rtdinvb, correction );
+      bmatrix-= correction;
+    }
+  }
+  return;
+}
+void Blue::solve( TVectorD& bvector ) const {
+  if( not ( m_valid & kFactor ) ) factorise();
+  if( m_method == kDenseCholesky ) {
+    TMatrixD bmatrix( bvector.GetNoElements(), 1 );
+    for( Int_t ivar= 0; ivar < bvector.GetNoElements(); ivar++ ) {
+      bmatrix(ivar,0)= bvector[ivar];
+    }
+    getLinearAlgebra().choleskySolve( getDenseFactor(), bmatrix );
+    for( Int_t ivar= 0; ivar < bvector.GetNoElements(); ivar++ ) {
+      bvector[ivar]= bmatrix(ivar,0);
+    }
+  }
+  else if( m_method == kBlockCholesky ) {
+    for( size_t iblock= 0; iblock < m_blocks.size(); iblock++ ) {
+      const vector<Int_t>& indices= m_blocks[iblock];
+      TVectorD bblock( indices.size() );
+      for( size_t i= 0; i < indices.size(); i++ ) {
+	bblock[i]= bvector[indices[i]];
+      }
+      m_blockchols[iblock].Solve( bblock );
+      for( size_t i= 0; i < indices.size(); i++ ) {
+	bvector[indices[i]]= bblock[i];
+      }
+    }
+  }
+  else {
+    for( Int_t ivar= 0; ivar < bvector.GetNoElements(); ivar++ ) {
+      bvector[ivar]*= m_diaginv[ivar];
+    }
+    if( m_lowrank.GetNcols() > 0 ) {
+      TVectorD rtdinvb= TMatrixD( TMatrixD::kTransposed, m_lowrank )*bvector;
+      m_capacitance.Solve( rtdinvb );
+      bvector-= m_dinvlowrank*rtdinvb;
+    }
+  }
+  return;
+}
+
+// Diagonal blocks of V as lists of measurement indices:
+const vector< vector<Int_t> >& Blue::getBlocks() const {
+  if( not ( m_valid & kFactor ) ) factorise();
+  return m_blocks;
+}
+
+// Upper triangular U with V= U^T U:
+const TMatrixD& Blue::getCholeskyFactor() const {
+  return getDenseFactor();
+}
+
+const AverageDataParser& Blue::getParser() const {
+  return m_parser;
+}
+
+// Upper triangular U with U^T U= V is changed to the factor of 
+// V + sign x x^T by rotations, hyperbolic ones for sign -1, in O(N^2).
+// Rows before the first nonzero element of x are unchanged. False if a
+// downdate leaves V not positive definite, U is then unusable:
+static bool updateFactor( TMatrixD& upper, TVectorD x, Double_t sign ) {
+  Int_t nvar= upper.GetNrows();
+  for( Int_t irow= 0; irow < nvar; irow++ ) {
+    if( x[irow] == 0.0 ) continue;
+    Double_t diagonal= upper(irow,irow);
+    Double_t radius2= diagonal*diagonal + sign*x[irow]*x[irow];
+    if( not ( radius2 > 0.0 ) ) return false;
+    Double_t radius= sqrt( radius2 );
+    Double_t cosine= radius/diagonal;
+    Double_t sine= x[irow]/diagonal;
+    upper(irow,irow)= radius;
+    for( Int_t icol= irow+1; icol < nvar; icol++ ) {
+      upper(irow,icol)= ( upper(irow,icol) + sign*sine*x[icol] )/cosine;
+      x[icol]= cosine*x[icol] - sine*upper(irow,icol);
+    }
+  }
+  return true;
+}
+
+// Mutators forward to the parser and invalidate only what depends on
+// the change: new values keep the factorisation and the weights, so 
+// average, chi^2 and pulls are recalculated in O(N^2). A new error or
+// correlation changes V by a symmetric rank-two term, written as one
+// rank-one update and one downdate of the factor, O(N^2) as well. Sources
+// gp and gpr change as a whole and whole sources are added or removed,
+// then V is factorised again. Failed updates throw like a failed 
+// factorisation:
+void Blue::setValue( Int_t ivar, Double_t value ) {
+  m_parser.setValue( ivar, value );
+  const CovoptionMap& covtypes= m_parser.getCovoptionTypes();
+  bool covchanged= false;
+  for( CovoptionMap::const_iterator mapitr= covtypes.begin();
+       mapitr != covtypes.end(); mapitr++ ) {
+    if( mapitr->second.type == kGlobalPartialRelative ) covchanged= true;
+  }
+  if( covchanged ) {
+    invalidate( kFactor );
+    factorise();
+  }
+  else {
+    invalidate( kAverage );
+  }
+  return;
+}
+void Blue::setError( const string& errorkey, Int_t ivar, Double_t error ) {
+  CovoptionMap::const_iterator typeitr= 
+    m_parser.getCovoptionTypes().find( errorkey );
+  if( typeitr == m_parser.getCovoptionTypes().end() or
+      typeitr->second.type == kGlobalPartial or
+      typeitr->second.type == kGlobalPartialRelative ) {
+    m_parser.setError( errorkey, ivar, error );
+    invalidate( kFactor );
+    factorise();
+    return;
+  }
+  getDenseFactor();
+  Int_t nvar= m_upper.GetNrows();
+  TVectorD column( nvar );
+  const CovarianceMap& sources= m_parser.getCovarianceSources();
+  for( Int_t jvar= 0; jvar < nvar; jvar++ ) {
+    column[jvar]= sources.find( errorkey )->second( jvar, ivar );
+  }
+  m_parser.setError( errorkey, ivar, error );
+  for( Int_t jvar= 0; jvar < nvar; jvar++ ) {
+    column[jvar]= sources.find( errorkey )->second( jvar, ivar ) - 
+      column[jvar];
+  }
+  column[ivar]*= 0.5;
+  updateDenseFactor( ivar, column );
+  return;
+}
+void Blue::addErrorSource( const string& errorkey, const TVectorD& errors,
+			   const string& covopt, 
+			   const string& correlations ) {
+  m_parser.addErrorSource( errorkey, errors, covopt, correlations );
+  invalidate( kFactor );
+  factorise();
+  return;
+}
+void Blue::removeErrorSource( const string& errorkey ) {
+  m_parser.removeErrorSource( errorkey );
+  invalidate( kFactor );
+  factorise();
+  return;
+}
+void Blue::setCorrelation( const string& errorkey, Int_t ivar, Int_t jvar,
+			   Double_t correlation ) {
+  getDenseFactor();
+  const CovarianceMap& sources= m_parser.getCovarianceSources();
+  CovarianceMap::const_iterator srcitr= sources.find( errorkey );
+  Double_t before= 
+    srcitr != sources.end() ? srcitr->second( ivar, jvar ) : 0.0;
+  m_parser.setCorrelation( errorkey, ivar, jvar, correlation );
+  TVectorD column( m_upper.GetNrows() );
+  column[jvar]= sources.find( errorkey )->second( ivar, jvar ) - before;
+  updateDenseFactor( ivar, column );
+  return;
+}
+// V + e_i b^T + b e_i^T= V + (x x^T - y y^T)/2 with x,y= t e_i +- b/t,
+// t^2= |b| keeps both terms of similar size:
+void Blue::updateDenseFactor( Int_t ivar, const TVectorD& column ) {
+  Double_t norm= sqrt( column.Norm2Sqr() );
+  if( norm == 0.0 ) return;
+  Double_t scale= sqrt( norm );
+  TVectorD plus( column );
+  plus*= 1.0/scale;
+  TVectorD minus( plus );
+  minus*= -1.0;
+  plus[ivar]+= scale;
+  minus[ivar]+= scale;
+  plus*= sqrt( 0.5 );
+  minus*= sqrt( 0.5 );
+  if( not updateFactor( m_upper, plus, 1.0 ) or
+      not updateFactor( m_upper, minus, -1.0 ) ) {
+    invalidate( kFactor );
+    throw BlueError( "total covariance matrix not positive definite" );
+  }
+  updatedDenseFactor();
+  return;
+}
+
+// Measurements are appended or removed with an O(N^2) update of the
+// upper triangular factor of V instead of a new factorisation: a new
+// last row and column borders U with U^T u= c and sqrt(d - u^T u), a
+// removed row and column leaves a rank-one update of the trailing part
+// of U. The first update takes U from the dense decomposition. Sources
+// gp and gpr depend on the minimum error of all measurements, with
+// those V is factorised again:
+void Blue::addMeasurement( const string& name, Double_t value,
+			   const ValueMap& errors,
+			   const StringMap& correlations,
+			   const string& group ) {
+  if( hasGlobalSources() ) {
+    m_parser.addMeasurement( name, value, errors, correlations, group );
+    invalidate( kFactor );
+    factorise();
+    return;
+  }
+  getDenseFactor();
+  m_parser.addMeasurement( name, value, errors, correlations, group );
+  Int_t nvar= m_upper.GetNrows();
+  TVectorD border( nvar );
+  Double_t diagonal= 0.0;
+  const CovarianceMap& sources= m_parser.getCovarianceSources();
+  for( CovarianceMap::const_iterator mapitr= sources.begin();
+       mapitr != sources.end(); mapitr++ ) {
+    const CovarianceSource& source= mapitr->second;
+    for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+      border[ivar]+= source( ivar, nvar );
+    }
+    diagonal+= source( nvar, nvar );
+  }
+  solveTransposed( m_upper, border );
+  Double_t pivot= diagonal;
+  for( Int_t ivar= 0; ivar < nvar; ivar++ ) pivot-= border[ivar]*border[ivar];
+  if( not ( pivot > 0.0 ) ) {
+    m_parser.removeMeasurement( nvar );
+    throw BlueError( "total covariance matrix not positive definite" );
+  }
+  m_upper.ResizeTo( nvar+1, nvar+1 );
+  for( Int_t ivar= 0; ivar < nvar; ivar++ ) m_upper(ivar,nvar)= border[ivar];
+  m_upper(nvar,nvar)= sqrt( pivot );
+  updatedDenseFactor();
+  return;
+}
+void Blue::removeMeasurement( Int_t ivar ) {
+  if( hasGlobalSources() ) {
+    m_parser.removeMeasurement( ivar );
+    invalidate( kFactor );
+    factorise();
+    return;
+  }
+  getDenseFactor();
+  m_parser.removeMeasurement( ivar );
+  Int_t nvar= m_upper.GetNrows()-1;
+  TMatrixD upper( nvar, nvar );
+  for( Int_t irow= 0; irow < nvar; irow++ ) {
+    Int_t iold= irow < ivar ? irow : irow+1;
+    for( Int_t icol= irow; icol < nvar; icol++ ) {
+      Int_t jold= icol < ivar ? icol : icol+1;
+      upper(irow,icol)= m_upper(iold,jold);
+    }
+  }
+  TVectorD update( nvar );
+  for( Int_t icol= ivar; icol < nvar; icol++ ) {
+    update[icol]= m_upper(ivar,icol+1);
+  }
+  updateFactor( upper, update, 1.0 );
+  m_upper.ResizeTo( upper );
+  m_upper= upper;
+  updatedDenseFactor();
+  return;
+}
+void Blue::updatedDenseFactor() const {
+  invalidate( kFactor );
+  m_method= kDenseCholesky;
+  m_blocks= findBlocks( m_parser.getCovarianceSources(), 
+			m_upper.GetNrows() );
+  m_valid|= kFactor | kCholesky;
+  return;
+}
+bool Blue::hasGlobalSources() const {
+  const CovoptionMap& covtypes= m_parser.getCovoptionTypes();
+  for( CovoptionMap::const_iterator mapitr= covtypes.begin();
+       mapitr != covtypes.end(); mapitr++ ) {
+    if( mapitr->second.type == kGlobalPartial or
+	mapitr->second.type == kGlobalPartialRelative ) return true;
+  }
+  return false;
+}
+
+const TMatrixD& Blue::getWeightsMatrix() const {
+  if( not ( m_valid & kWeights ) ) calcWeightsMatrix();
   return m_weightsmatrix;
 }
-void Blue::calcWeightsMatrix() {
-  TMatrixD gm( m_parser.getGroupMatrix() );
-  TMatrixD gmT( gm );
-  gmT.T();
-  TMatrixDSym invm( m_invm );
-  TMatrixDSym& utvinvuinv= invm.SimilarityT( gm );
+// W= (G^T V^-1 G)^-1 G^T V^-1 with V^-1 G from the factorisation,
+// (G^T V^-1 G)^-1 is also the total covariance of the averages. G^T X
+// are sums over groups:
+void Blue::calcWeightsMatrix() const {
+  const GroupMap& groups= m_parser.getGroupMap();
+  TMatrixD vinvgm( groups.getMatrix() );
+  solve( vinvgm );
+  TMatrixD utvinvuinv( groups.sum( vinvgm ) );
   utvinvuinv.Invert();
-  m_weightsmatrix.ResizeTo( gm.GetNcols(), gm.GetNrows() );
-  m_weightsmatrix= utvinvuinv*gmT*m_invm;
+  Int_t navg= groups.getNgroups();
+  m_avgcov.ResizeTo( navg, navg );
+  for( Int_t iavg= 0; iavg < navg; iavg++ ) {
+    for( Int_t javg= 0; javg < navg; javg++ ) {
+      m_avgcov(iavg,javg)= utvinvuinv(iavg,javg);
+    }
+  }
+  m_weightsmatrix.ResizeTo( navg, groups.getNvar() );
+  m_weightsmatrix= TMatrixD( utvinvuinv, TMatrixD::kMultTranspose, vinvgm );
+  m_valid|= kWeights;
   return;
 }
 
-TVectorD Blue::getAverage() const {
+// Total errors of the averages without the error analysis per source:
+TVectorD Blue::getTotalErrors() const {
+  if( not ( m_valid & kWeights ) ) calcWeightsMatrix();
+  Int_t navg= m_avgcov.GetNrows();
+  TVectorD errors( navg );
+  for( Int_t iavg= 0; iavg < navg; iavg++ ) {
+    errors[iavg]= sqrt( m_avgcov(iavg,iavg) );
+  }
+  return errors;
+}
+
+const TVectorD& Blue::getAverage() const {
+  if( not ( m_valid & kAverage ) ) calcAverage();
   return m_average;
 }
-void Blue::calcAverage() {
-  TVectorD data= m_parser.getValues();
-  m_average.ResizeTo( m_weightsmatrix.GetNrows() );
-  m_average= m_weightsmatrix*data;
+void Blue::calcAverage() const {
+  const TVectorD& data= m_parser.getValues();
+  const TMatrixD& weightsmatrix= getWeightsMatrix();
+  m_average.ResizeTo( weightsmatrix.GetNrows() );
+  m_average= weightsmatrix*data;
+  m_valid|= kAverage;
   return;
 }
 
 Double_t Blue::getChisq() const {
+  if( not ( m_valid & kChisq ) ) calcChisq();
   return m_chisq;
 }
-void Blue::calcChisq() {
-  TVectorD data= m_parser.getValues();
-  TMatrixD gm= m_parser.getGroupMatrix();
-  TVectorD delta= data - gm*m_average;
-  TMatrixDSym invm( m_invm );
-  m_chisq= invm.Similarity( delta );
+void Blue::calcChisq() const {
+  const TVectorD& data= m_parser.getValues();
+  const GroupMap& groups= m_parser.getGroupMap();
+  TVectorD delta= data - groups.expand( getAverage() );
+  TVectorD vinvdelta( delta );
+  solve( vinvdelta );
+  m_chisq= delta*vinvdelta;
+  m_valid|= kChisq;
   return;
 }
 
-TVectorD Blue::getPulls() const {
+const TVectorD& Blue::getPulls() const {
+  if( not ( m_valid & kPulls ) ) calcPulls();
   return m_pulls;
 }
-void Blue::calcPulls() {
-  TVectorD data= m_parser.getValues();
-  TMatrixD gm= m_parser.getGroupMatrix();
-  TVectorD totalerrors= m_parser.getTotalErrors();
-  TVectorD delta= data - gm*m_average;
+void Blue::calcPulls() const {
+  const TVectorD& data= m_parser.getValues();
+  const GroupMap& groups= m_parser.getGroupMap();
+  const TVectorD& totalerrors= m_parser.getTotalErrors();
+  TVectorD delta= data - groups.expand( getAverage() );
   Int_t nerr= data.GetNoElements();
   m_pulls.ResizeTo( nerr );
   for( Int_t ierr= 0; ierr < nerr; ierr++ ) {
     m_pulls[ierr]= delta[ierr]/totalerrors[ierr];
   }
+  m_valid|= kPulls;
   return;
 }
 
-MatrixMap Blue::getErrors() const {
+const MatrixMap& Blue::getErrors() const {
+  if( not ( m_valid & kErrors ) ) errorAnalysis();
   return m_errorsmap;
 }
-void Blue::errorAnalysis() {
-  MatrixMap covariances= m_parser.getCovariances();
-  Int_t navg= m_weightsmatrix.GetNrows();
+// Covariances of the averages per error source W C W^T, O(M N) for
+// sources in compact form. Sources are shared out over threads for
+// larger inputs, each writes its own slot and the sums for syst and
+// total are made afterwards in the order of the map:
+class ErrorAnalysisTask: public ParallelTask {
+public:
+  ErrorAnalysisTask( const vector<const CovarianceSource*>& sources,
+		     const TMatrixD& weightsmatrix,
+		     vector<TMatrixDSym>& results ) :
+    m_sources( sources ), m_weightsmatrix( weightsmatrix ), 
+    m_results( results ) {}
+  virtual void operator()( size_t isource, unsigned ) {
+    TMatrixDSym cov= m_sources[isource]->similarity( m_weightsmatrix );
+    m_results[isource].ResizeTo( cov );
+    m_results[isource]= cov;
+  }
+private:
+  const vector<const CovarianceSource*>& m_sources;
+  const TMatrixD& m_weightsmatrix;
+  vector<TMatrixDSym>& m_results;
+};
+void Blue::errorAnalysis() const {
+  const CovarianceMap& sources= m_parser.getCovarianceSources();
+  const TMatrixD& weightsmatrix= getWeightsMatrix();
+  Int_t navg= weightsmatrix.GetNrows();
+  vector<const CovarianceSource*> sourcelist;
+  for( CovarianceMap::const_iterator mapitr= sources.begin();
+       mapitr != sources.end(); mapitr++ ) {
+    sourcelist.push_back( &mapitr->second );
+  }
+  vector<TMatrixDSym> covs( sourcelist.size() );
+  ErrorAnalysisTask task( sourcelist, weightsmatrix, covs );
+  parallelFor( sourcelist.size(), task, 
+	       weightsmatrix.GetNcols() >= minParallelSize ? 0 : 1 );
   TMatrixDSym avgsystcov( navg );
   TMatrixDSym avgtotcov( navg );
-  for( MatrixMap::iterator mapitr= covariances.begin();
-       mapitr != covariances.end(); mapitr++ ) {
+  m_errorsmap.clear();
+  size_t isource= 0;
+  for( CovarianceMap::const_iterator mapitr= sources.begin();
+       mapitr != sources.end(); mapitr++, isource++ ) {
     const string& errorkey= mapitr->first;
-    TMatrixDSym cov= mapitr->second;
-    cov.Similarity( m_weightsmatrix );
+    const TMatrixDSym& cov= covs[isource];
     avgtotcov+= cov;
     if( errorkey.find( "stat" ) == string::npos ) avgsystcov+= cov;
     m_errorsmap.insert( MatrixMap::value_type( errorkey, cov ) );
   }
   m_errorsmap.insert( MatrixMap::value_type( "syst", avgsystcov ) );
   m_errorsmap.insert( MatrixMap::value_type( "total", avgtotcov ) );
+  m_valid|= kErrors;
   return;
 }
 
+// Combine the columns of an N x K matrix of alternative values with the
+// weights and factorisation of this combination, chi^2 for all columns
+// from one multi-solve:
+batch_t Blue::combineBatch( const TMatrixD& values ) const {
+  const TMatrixD& weightsmatrix= getWeightsMatrix();
+  Int_t nvar= weightsmatrix.GetNcols();
+  if( values.GetNrows() != nvar ) {
+    std::stringstream strstr;
+    strstr << "batch values need " << nvar << " rows, got " 
+	   << values.GetNrows();
+    throw BlueError( strstr.str() );
+  }
+  Int_t nbatch= values.GetNcols();
+  batch_t results;
+  results.averages.ResizeTo( weightsmatrix.GetNrows(), nbatch );
+  results.averages= weightsmatrix*values;
+  TMatrixD delta( values );
+  delta-= m_parser.getGroupMap().expand( results.averages );
+  TMatrixD vinvdelta( delta );
+  solve( vinvdelta );
+  const TVectorD& totalerrors= m_parser.getTotalErrors();
+  results.chisq.ResizeTo( nbatch );
+  results.pulls.ResizeTo( nvar, nbatch );
+  for( Int_t ibatch= 0; ibatch < nbatch; ibatch++ ) {
+    Double_t chisq= 0.0;
+    for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+      chisq+= delta(ivar,ibatch)*vinvdelta(ivar,ibatch);
+      results.pulls(ivar,ibatch)= delta(ivar,ibatch)/totalerrors[ivar];
+    }
+    results.chisq[ibatch]= chisq;
+  }
+  return results;
+}
+
+// Derivatives with r= V^-1 (y - G average): d average= -W dV r and
+// d cov(averages)= W dV W^T. For all error sources except gp and gpr
+// dV by error i is e_i a_i^T + a_i e_i^T with a_i the derivative of 
+// row i of the source covariance by error i, the diagonal element 
+// halved. Column i of D holds a_i, then W D and D^T r give the
+// derivatives by all errors of a source in O(M N^2). For gp and gpr
+// the smallest (relative) error also sets the common part p^2 u u^T of
+// all off-diagonal elements, u= 1 for gp and u= y for gpr, this adds 
+// 2 p dp (u u^T - diag(u^2)) to dV by that error:
+static Double_t letterDerivative( CovarianceType type, 
+				  const TVectorD& errors, Int_t ierr, 
+				  Int_t jerr ) {
+  if( ierr == jerr ) return errors[ierr];
+  switch( type ) {
+  case kFull:
+    return errors[jerr];
+  case kAnti:
+    return -errors[jerr];
+  case kPartial:
+    if( errors[ierr] < errors[jerr] ) return 2.0*errors[ierr];
+    if( errors[ierr] == errors[jerr] ) return errors[ierr];
+    return 0.0;
+  default:
+    return 0.0;
+  }
+}
+class SensitivityTask: public ParallelTask {
+public:
+  SensitivityTask( const AverageDataParser& parser, 
+		   const vector<string>& keys, const TMatrixD& weightsmatrix,
+		   const TVectorD& residuals, const TVectorD& avgerrors,
+		   vector<TMatrixD>& averages, vector<TMatrixD>& errors ) :
+    m_parser( parser ), m_keys( keys ), m_weightsmatrix( weightsmatrix ),
+    m_residuals( residuals ), m_avgerrors( avgerrors ), 
+    m_averages( averages ), m_errors( errors ) {}
+  virtual void operator()( size_t isource, unsigned ) {
+    const string& errorkey= m_keys[isource];
+    const TVectorD& errors= m_parser.getErrors().find( errorkey )->second;
+    CovarianceType type= 
+      m_parser.getCovoptionTypes().find( errorkey )->second.type;
+    Int_t nvar= errors.GetNoElements();
+    Int_t navg= m_weightsmatrix.GetNrows();
+    TMatrixD derivatives( nvar, nvar );
+    const TMatrixD* corrmatrix= 0;
+    const LetterMatrix* letters= 0;
+    if( type == kCorrelationMatrix ) {
+      corrmatrix= &m_parser.getCorrelationMatrices().find( errorkey )->second;
+    }
+    else if( type == kLetterMatrix ) {
+      letters= &m_parser.getLetterMatrices().find( errorkey )->second;
+    }
+    for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+      for( Int_t jvar= 0; jvar < nvar; jvar++ ) {
+	Double_t derivative= 0.0;
+	if( corrmatrix ) {
+	  derivative= (*corrmatrix)(ivar,jvar)*errors[jvar];
+	}
+	else if( letters ) {
+	  CovarianceType letter= CovarianceType( (*letters)[ivar*nvar+jvar] );
+	  derivative= letterDerivative( letter, errors, ivar, jvar );
+	}
+	else {
+	  derivative= letterDerivative( type, errors, ivar, jvar );
+	}
+	derivatives(jvar,ivar)= derivative;
+      }
+    }
+    TMatrixD wd( navg, nvar );
+    getLinearAlgebra().multiply( m_weightsmatrix, derivatives, wd );
+    TVectorD dtr( nvar );
+    for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+      Double_t sum= 0.0;
+      for( Int_t jvar= 0; jvar < nvar; jvar++ ) {
+	sum+= derivatives(jvar,ivar)*m_residuals[jvar];
+      }
+      dtr[ivar]= sum;
+    }
+    TMatrixD& dav= m_averages[isource];
+    TMatrixD& derr= m_errors[isource];
+    dav.ResizeTo( navg, nvar );
+    derr.ResizeTo( navg, nvar );
+    for( Int_t iavg= 0; iavg < navg; iavg++ ) {
+      for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+	Double_t weight= m_weightsmatrix(iavg,ivar);
+	dav(iavg,ivar)= -( weight*dtr[ivar] + wd(iavg,ivar)*m_residuals[ivar] );
+	derr(iavg,ivar)= weight*wd(iavg,ivar)/m_avgerrors[iavg];
+      }
+    }
+    if( type == kGlobalPartial or type == kGlobalPartialRelative ) {
+      addCommonPart( type, errors, dav, derr );
+    }
+  }
+private:
+  void addCommonPart( CovarianceType type, const TVectorD& errors,
+		      TMatrixD& dav, TMatrixD& derr ) const {
+    Int_t nvar= errors.GetNoElements();
+    Int_t navg= m_weightsmatrix.GetNrows();
+    const TVectorD& values= m_parser.getValues();
+    TVectorD u( nvar );
+    Int_t imin= 0;
+    for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+      u[ivar]= type == kGlobalPartial ? 1.0 : values[ivar];
+      if( errors[ivar]/u[ivar] < errors[imin]/u[imin] ) imin= ivar;
+    }
+    Double_t scale= 2.0*errors[imin]/u[imin]/u[imin];
+    Double_t utr= 0.0;
+    for( Int_t ivar= 0; ivar < nvar; ivar++ ) utr+= u[ivar]*m_residuals[ivar];
+    for( Int_t iavg= 0; iavg < navg; iavg++ ) {
+      Double_t wu= 0.0;
+      Double_t wu2r= 0.0;
+      Double_t w2u2= 0.0;
+      for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+	Double_t weight= m_weightsmatrix(iavg,ivar);
+	wu+= weight*u[ivar];
+	wu2r+= weight*u[ivar]*u[ivar]*m_residuals[ivar];
+	w2u2+= weight*weight*u[ivar]*u[ivar];
+      }
+      dav(iavg,imin)-= scale*( wu*utr - wu2r );
+      derr(iavg,imin)+= scale*( wu*wu - w2u2 )/( 2.0*m_avgerrors[iavg] );
+    }
+    return;
+  }
+  const AverageDataParser& m_parser;
+  const vector<string>& m_keys;
+  const TMatrixD& m_weightsmatrix;
+  const TVectorD& m_residuals;
+  const TVectorD& m_avgerrors;
+  vector<TMatrixD>& m_averages;
+  vector<TMatrixD>& m_errors;
+};
+sensitivity_t Blue::getSensitivities( unsigned nthreads ) const {
+  const TMatrixD& weightsmatrix= getWeightsMatrix();
+  const TVectorD& values= m_parser.getValues();
+  TVectorD residuals= values - m_parser.getGroupMap().expand( getAverage() );
+  solve( residuals );
+  TVectorD avgerrors= getTotalErrors();
+  vector<string> keys;
+  const VectorMap& errorsmap= m_parser.getErrors();
+  for( VectorMap::const_iterator mapitr= errorsmap.begin();
+       mapitr != errorsmap.end(); mapitr++ ) {
+    keys.push_back( mapitr->first );
+  }
+  vector<TMatrixD> averages( keys.size() );
+  vector<TMatrixD> errors( keys.size() );
+  SensitivityTask task( m_parser, keys, weightsmatrix, residuals, avgerrors,
+			averages, errors );
+  if( nthreads == 0 and values.GetNoElements() < minParallelSize ) {
+    nthreads= 1;
+  }
+  parallelFor( keys.size(), task, nthreads );
+  sensitivity_t result;
+  result.values.ResizeTo( weightsmatrix );
+  result.values= weightsmatrix;
+  for( size_t ikey= 0; ikey < keys.size(); ikey++ ) {
+    result.averages[keys[ikey]].ResizeTo( averages[ikey] );
+    result.averages[keys[ikey]]= averages[ikey];
+    result.errors[keys[ikey]].ResizeTo( errors[ikey] );
+    result.errors[keys[ikey]]= errors[ikey];
+  }
+  return result;
+}
+
+// All N leave-one-out combinations from the full inverse V^-1: removing
+// measurement i downdates V^-1 to V^-1 - b b^T/V^-1(i,i) with b column i
+// of V^-1, which is zero in row and column i and equals the inverse of
+// the reduced covariance otherwise. G^T V^-1 G, G^T V^-1 y and y^T V^-1 y
+// then follow by rank-one downdates of M x M quantities, O(N^3) in total.
+// Sources gp and gpr change with the minimum error of the remaining 
+// measurements, with those every row is a new combination:
+jackknife_t Blue::jackknife() const {
+  if( hasGlobalSources() ) return recombineJackknife();
+  const GroupMap& groups= m_parser.getGroupMap();
+  const TVectorD& data= m_parser.getValues();
+  Int_t nvar= groups.getNvar();
+  Int_t navg= groups.getNgroups();
+  TMatrixD vinv( nvar, nvar );
+  vinv.UnitMatrix();
+  solve( vinv );
+  TMatrixD vinvgm( TMatrixD::kTransposed, groups.sum( vinv ) );
+  TMatrixD utvinvu( groups.sum( vinvgm ) );
+  TVectorD vinvdata= vinv*data;
+  TVectorD utvinvdata= groups.sum( vinvdata );
+  Double_t dataVinvdata= data*vinvdata;
+  vector<Int_t> groupsizes= groups.getGroupSizes();
+  jackknife_t results;
+  results.averages.ResizeTo( nvar, navg );
+  results.errors.ResizeTo( nvar, navg );
+  results.chisq.ResizeTo( nvar );
+  results.valid.assign( nvar, false );
+  for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+    if( groupsizes[groups[ivar]] < 2 ) continue;
+    Double_t vinvii= vinv(ivar,ivar);
+    Double_t hi= vinvdata[ivar];
+    TMatrixDSym utvinvui( navg );
+    TVectorD utvinvdatai( navg );
+    for( Int_t iavg= 0; iavg < navg; iavg++ ) {
+      Double_t giavg= vinvgm(ivar,iavg);
+      for( Int_t javg= 0; javg < navg; javg++ ) {
+	utvinvui(iavg,javg)= utvinvu(iavg,javg) - 
+	  giavg*vinvgm(ivar,javg)/vinvii;
+      }
+      utvinvdatai[iavg]= utvinvdata[iavg] - giavg*hi/vinvii;
+    }
+    TDecompChol chol( utvinvui );
+    if( not chol.Decompose() ) continue;
+    TVectorD average( utvinvdatai );
+    chol.Solve( average );
+    TMatrixDSym avgcov( navg );
+    chol.Invert( avgcov );
+    for( Int_t iavg= 0; iavg < navg; iavg++ ) {
+      results.averages(ivar,iavg)= average[iavg];
+      results.errors(ivar,iavg)= sqrt( avgcov(iavg,iavg) );
+    }
+    results.chisq[ivar]= dataVinvdata - hi*hi/vinvii - 
+      utvinvdatai*average;
+    results.valid[ivar]= true;
+  }
+  return results;
+}
+jackknife_t Blue::recombineJackknife() const {
+  const GroupMap& groups= m_parser.getGroupMap();
+  Int_t nvar= groups.getNvar();
+  Int_t navg= groups.getNgroups();
+  vector<Int_t> groupsizes= groups.getGroupSizes();
+  jackknife_t results;
+  results.averages.ResizeTo( nvar, navg );
+  results.errors.ResizeTo( nvar, navg );
+  results.chisq.ResizeTo( nvar );
+  results.valid.assign( nvar, false );
+  for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+    if( groupsizes[groups[ivar]] < 2 ) continue;
+    AverageDataParser parser( m_parser );
+    parser.removeMeasurement( ivar );
+    try {
+      Blue reduced( parser );
+      const TVectorD& average= reduced.getAverage();
+      TVectorD errors= reduced.getTotalErrors();
+      for( Int_t iavg= 0; iavg < navg; iavg++ ) {
+	results.averages(ivar,iavg)= average[iavg];
+	results.errors(ivar,iavg)= errors[iavg];
+      }
+      results.chisq[ivar]= reduced.getChisq();
+      results.valid[ivar]= true;
+    }
+    catch( const std::exception& ) {}
+  }
+  return results;
+}
+
+// Correlation scans with the Woodbury identity: with B the total 
+// covariance without the scanned entries and P the unit columns of the
+// measurements involved, V(rho)= B + P K(rho) P^T and
+// V(rho)^-1= B^-1 - B^-1 P (1 + K P^T B^-1 P)^-1 K P^T B^-1.
+// G^T V^-1 G, G^T V^-1 y and y^T V^-1 y then need only r x r work per
+// grid point after B is factorised once, r the number of measurements
+// involved. V(rho) is positive definite when 1 + U K U^T is, with 
+// P^T B^-1 P= U^T U, which has the eigenvalues of the capacitance 
+// matrix 1 + K P^T B^-1 P. Measurements in several scanned sources are
+// columns of P more than once, for the check K is summed onto distinct
+// measurements where P^T B^-1 P is positive definite. Grid points are 
+// independent and run in parallel:
+class CorrelationScanPoint: public ParallelTask {
+public:
+  CorrelationScanPoint( const vector<corrscan_t>& sources,
+			const vector<TMatrixD>& kblocks,
+			const vector<Int_t>& indices,
+			const TMatrixD& ptbinvp, const TMatrixD& ptbinvgm, 
+			const TVectorD& ptbinvdata, const TMatrixD& utbinvu,
+			const TVectorD& utbinvdata, Double_t databinvdata,
+			scan_t& results, vector<char>& valid ) :
+    m_sources( sources ), m_kblocks( kblocks ), m_ptbinvp( ptbinvp ), 
+    m_ptbinvgm( ptbinvgm ), m_ptbinvdata( ptbinvdata ), 
+    m_utbinvu( utbinvu ), m_utbinvdata( utbinvdata ), 
+    m_databinvdata( databinvdata ), m_results( results ), 
+    m_valid( valid ) {
+    vector<Int_t> first;
+    for( size_t k= 0; k < indices.size(); k++ ) {
+      size_t idistinct= 0;
+      while( idistinct < first.size() and 
+	     indices[first[idistinct]] != indices[k] ) idistinct++;
+      if( idistinct == first.size() ) first.push_back( k );
+      m_distinct.push_back( idistinct );
+    }
+    Int_t nd= first.size();
+    TMatrixDSym ptbinvpsym( nd );
+    for( Int_t i= 0; i < nd; i++ ) {
+      for( Int_t j= 0; j < nd; j++ ) {
+	ptbinvpsym(i,j)= ptbinvp(first[i],first[j]);
+      }
+    }
+    TDecompChol chol( ptbinvpsym );
+    m_factorvalid= chol.Decompose();
+    if( m_factorvalid ) {
+      m_ptbinvpupper.ResizeTo( nd, nd );
+      m_ptbinvpupper= chol.GetU();
+    }
+  }
+  void operator()( size_t ipoint, unsigned ) {
+    Int_t nsrc= m_sources.size();
+    Int_t nr= m_ptbinvp.GetNrows();
+    Int_t navg= m_utbinvu.GetNrows();
+    TMatrixD kmatrix( nr, nr );
+    size_t index= ipoint;
+    Int_t offset= nr;
+    for( Int_t isrc= nsrc-1; isrc >= 0; isrc-- ) {
+      const TVectorD& rhos= m_sources[isrc].rhos;
+      Double_t rho= rhos[index % rhos.GetNoElements()];
+      index/= rhos.GetNoElements();
+      m_results.rhos(ipoint,isrc)= rho;
+      const TMatrixD& kblock= m_kblocks[isrc];
+      Int_t nblock= kblock.GetNrows();
+      offset-= nblock;
+      for( Int_t i= 0; i < nblock; i++ ) {
+	for( Int_t j= 0; j < nblock; j++ ) {
+	  kmatrix(offset+i,offset+j)= rho*kblock(i,j);
+	}
+      }
+    }
+    m_valid[ipoint]= 0;
+    if( not m_factorvalid ) return;
+    Int_t nd= m_ptbinvpupper.GetNrows();
+    TMatrixD kdistinct( nd, nd );
+    for( Int_t i= 0; i < nr; i++ ) {
+      for( Int_t j= 0; j < nr; j++ ) {
+	kdistinct(m_distinct[i],m_distinct[j])+= kmatrix(i,j);
+      }
+    }
+    TMatrixD uk( m_ptbinvpupper, TMatrixD::kMult, kdistinct );
+    TMatrixD uku( uk, TMatrixD::kMultTranspose, m_ptbinvpupper );
+    TMatrixDSym capacitancesym( nd );
+    for( Int_t i= 0; i < nd; i++ ) {
+      for( Int_t j= 0; j < nd; j++ ) {
+	capacitancesym(i,j)= 0.5*( uku(i,j) + uku(j,i) );
+      }
+      capacitancesym(i,i)+= 1.0;
+    }
+    TDecompChol capacitancechol( capacitancesym );
+    if( not capacitancechol.Decompose() ) return;
+    TMatrixD capacitance( kmatrix, TMatrixD::kMult, m_ptbinvp );
+    for( Int_t i= 0; i < nr; i++ ) capacitance(i,i)+= 1.0;
+    capacitance.Invert();
+    TMatrixD tmatrix( capacitance, TMatrixD::kMult, kmatrix );
+    TMatrixD ftt( m_ptbinvgm, TMatrixD::kTransposeMult, tmatrix );
+    TMatrixD utvinvu( ftt, TMatrixD::kMult, m_ptbinvgm );
+    TVectorD utvinvdata= ftt*m_ptbinvdata;
+    TVectorD tdata= tmatrix*m_ptbinvdata;
+    TMatrixDSym utvinvusym( navg );
+    for( Int_t iavg= 0; iavg < navg; iavg++ ) {
+      utvinvdata[iavg]= m_utbinvdata[iavg] - utvinvdata[iavg];
+      for( Int_t javg= 0; javg < navg; javg++ ) {
+	utvinvusym(iavg,javg)= m_utbinvu(iavg,javg) - utvinvu(iavg,javg);
+      }
+    }
+    TDecompChol chol( utvinvusym );
+    if( not chol.Decompose() ) return;
+    TVectorD average( utvinvdata );
+    chol.Solve( average );
+    TMatrixDSym avgcov( navg );
+    chol.Invert( avgcov );
+    for( Int_t iavg= 0; iavg < navg; iavg++ ) {
+      m_results.averages(ipoint,iavg)= average[iavg];
+      m_results.errors(ipoint,iavg)= sqrt( avgcov(iavg,iavg) );
+    }
+    m_results.chisq[ipoint]= m_databinvdata - m_ptbinvdata*tdata - 
+      utvinvdata*average;
+    m_valid[ipoint]= 1;
+  }
+private:
+  const vector<corrscan_t>& m_sources;
+  const vector<TMatrixD>& m_kblocks;
+  const TMatrixD& m_ptbinvp;
+  const TMatrixD& m_ptbinvgm;
+  const TVectorD& m_ptbinvdata;
+  const TMatrixD& m_utbinvu;
+  const TVectorD& m_utbinvdata;
+  Double_t m_databinvdata;
+  scan_t& m_results;
+  vector<char>& m_valid;
+  vector<Int_t> m_distinct;
+  TMatrixD m_ptbinvpupper;
+  bool m_factorvalid;
+};
+scan_t Blue::scanCorrelations( const vector<corrscan_t>& sources,
+			       unsigned nthreads ) const {
+  const CovarianceMap& covariances= m_parser.getCovarianceSources();
+  const VectorMap& errorsmap= m_parser.getErrors();
+  TMatrixDSym basecov= m_parser.getTotalCovariances();
+  Int_t nvar= basecov.GetNrows();
+  vector<Int_t> indices;
+  vector<TMatrixD> kblocks;
+  size_t npoints= 1;
+  for( size_t isrc= 0; isrc < sources.size(); isrc++ ) {
+    const corrscan_t& source= sources[isrc];
+    VectorMap::const_iterator erritr= errorsmap.find( source.errorkey );
+    if( erritr == errorsmap.end() ) {
+      throw BlueError( "scan error source " + source.errorkey + 
+		       " not found" );
+    }
+    const TVectorD& errors= erritr->second;
+    const CovarianceSource& cov= covariances.find( source.errorkey )->second;
+    std::set< std::pair<Int_t,Int_t> > pairs;
+    for( size_t ipair= 0; ipair < source.pairs.size(); ipair++ ) {
+      Int_t ivar= std::min( source.pairs[ipair].first, 
+			    source.pairs[ipair].second );
+      Int_t jvar= std::max( source.pairs[ipair].first, 
+			    source.pairs[ipair].second );
+      if( ivar < 0 or jvar >= nvar or ivar == jvar ) {
+	throw BlueError( "scan pair of " + source.errorkey + 
+			 " not an off-diagonal element" );
+      }
+      pairs.insert( std::make_pair( ivar, jvar ) );
+    }
+    if( source.pairs.empty() ) {
+      for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+	for( Int_t jvar= ivar+1; jvar < nvar; jvar++ ) {
+	  if( errors[ivar] != 0.0 and errors[jvar] != 0.0 ) {
+	    pairs.insert( std::make_pair( ivar, jvar ) );
+	  }
+	}
+      }
+    }
+    std::set<Int_t> involved;
+    for( std::set< std::pair<Int_t,Int_t> >::const_iterator pairitr= 
+	   pairs.begin(); pairitr != pairs.end(); pairitr++ ) {
+      involved.insert( pairitr->first );
+      involved.insert( pairitr->second );
+    }
+    vector<Int_t> blockindices( involved.begin(), involved.end() );
+    TMatrixD kblock( blockindices.size(), blockindices.size() );
+    for( std::set< std::pair<Int_t,Int_t> >::const_iterator pairitr= 
+	   pairs.begin(); pairitr != pairs.end(); pairitr++ ) {
+      Int_t ivar= pairitr->first;
+      Int_t jvar= pairitr->second;
+      basecov(ivar,jvar)-= cov(ivar,jvar);
+      basecov(jvar,ivar)-= cov(jvar,ivar);
+      Int_t i= std::lower_bound( blockindices.begin(), blockindices.end(), 
+				 ivar ) - blockindices.begin();
+      Int_t j= std::lower_bound( blockindices.begin(), blockindices.end(), 
+				 jvar ) - blockindices.begin();
+      kblock(i,j)= kblock(j,i)= errors[ivar]*errors[jvar];
+    }
+    indices.insert( indices.end(), blockindices.begin(), 
+		    blockindices.end() );
+    kblocks.push_back( kblock );
+    npoints*= source.rhos.GetNoElements();
+  }
+  TDecompChol chol( basecov );
+  if( not chol.Decompose() ) {
+    throw BlueError( "covariance without scanned correlations not positive definite" );
+  }
+  Int_t nr= indices.size();
+  TMatrixD binvp( nvar, nr );
+  for( Int_t k= 0; k < nr; k++ ) binvp(indices[k],k)= 1.0;
+  chol.MultiSolve( binvp );
+  const GroupMap& groups= m_parser.getGroupMap();
+  Int_t navg= groups.getNgroups();
+  TMatrixD binvgm( groups.getMatrix() );
+  chol.MultiSolve( binvgm );
+  const TVectorD& data= m_parser.getValues();
+  TVectorD binvdata( data );
+  chol.Solve( binvdata );
+  TMatrixD ptbinvp( nr, nr );
+  TMatrixD ptbinvgm( nr, navg );
+  TVectorD ptbinvdata( nr );
+  for( Int_t k= 0; k < nr; k++ ) {
+    for( Int_t l= 0; l < nr; l++ ) ptbinvp(k,l)= binvp(indices[k],l);
+    for( Int_t iavg= 0; iavg < navg; iavg++ ) {
+      ptbinvgm(k,iavg)= binvgm(indices[k],iavg);
+    }
+    ptbinvdata[k]= binvdata[indices[k]];
+  }
+  TMatrixD utbinvu( groups.sum( binvgm ) );
+  TVectorD utbinvdata= groups.sum( binvdata );
+  scan_t results;
+  results.rhos.ResizeTo( npoints, sources.size() );
+  results.averages.ResizeTo( npoints, navg );
+  results.errors.ResizeTo( npoints, navg );
+  results.chisq.ResizeTo( npoints );
+  vector<char> valid( npoints, 0 );
+  CorrelationScanPoint task( sources, kblocks, indices, ptbinvp, ptbinvgm, 
+			     ptbinvdata, utbinvu, utbinvdata, 
+			     data*binvdata, results, valid );
+  parallelFor( npoints, task, nthreads );
+  results.valid.assign( valid.begin(), valid.end() );
+  return results;
+}
+scan_t Blue::scanCorrelation( const string& errorkey, const TVectorD& rhos,
+			      const vector< std::pair<Int_t,Int_t> >& pairs,
+			      unsigned nthreads ) const {
+  vector<corrscan_t> sources( 1 );
+  sources[0].errorkey= errorkey;
+  sources[0].rhos.ResizeTo( rhos );
+  sources[0].rhos= rhos;
+  sources[0].pairs= pairs;
+  return scanCorrelations( sources, nthreads );
+}
+
 void Blue::printInputs( std::ostream& ost ) const {
   ost << "\nBest Linear Unbiased Estimator average\n" << std::endl;
   m_parser.printFilename( ost );
@@ -141,12 +1278,14 @@ void Blue::printResults( std::ostream& ost ) const {
 }
 
 void Blue::printChisq( std::ostream& ost ) const {
-  Int_t ndof= m_weightsmatrix.GetNcols() - m_weightsmatrix.GetNrows();
-  Double_t chisqdof= m_chisq/Double_t(ndof);
-  Double_t pvalue= TMath::Prob( m_chisq, ndof );
+  const TMatrixD& weightsmatrix= getWeightsMatrix();
+  Int_t ndof= weightsmatrix.GetNcols() - weightsmatrix.GetNrows();
+  Double_t chisq= getChisq();
+  Double_t chisqdof= chisq/Double_t(ndof);
+  Double_t pvalue= TMath::Prob( chisq, ndof );
   ost.precision( 2 );
   ost.setf( std::ios_base::fixed );
-  ost << "Chi^2= " << m_chisq << " for " << ndof << " d.o.f,"
+  ost << "Chi^2= " << chisq << " for " << ndof << " d.o.f,"
       << " chi^2/d.o.f= " << chisqdof;
   ost.precision( 4 );
   ost << ", P(chi^2)= " << pvalue << std::endl;
@@ -154,9 +1293,10 @@ void Blue::printChisq( std::ostream& ost ) const {
 }
 
 void Blue::printWeights( std::ostream& ost ) const {
-  Int_t navg= m_weightsmatrix.GetNrows();
-  Int_t nvar= m_weightsmatrix.GetNcols();
-  vector<string> uniquegroups= m_parser.getUniqueGroups();
+  const TMatrixD& weightsmatrix= getWeightsMatrix();
+  Int_t navg= weightsmatrix.GetNrows();
+  Int_t nvar= weightsmatrix.GetNcols();
+  const vector<string>& uniquegroups= m_parser.getUniqueGroups();
   ost.precision( 4 );
   ost.setf( std::ios_base::fixed );
   for( Int_t iavg= 0; iavg < navg; iavg++ ) {
@@ -164,7 +1304,7 @@ void Blue::printWeights( std::ostream& ost ) const {
     if( uniquegroups.size() > 1 ) txt+= " " + uniquegroups.at( iavg );
     ost << std::setw( 11 ) << txt+":";
     for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
-      ost << " " << std::setw(10) << m_weightsmatrix(iavg,ivar);
+      ost << " " << std::setw(10) << weightsmatrix(iavg,ivar);
     }
     ost << std::endl;
   }
@@ -172,11 +1312,41 @@ void Blue::printWeights( std::ostream& ost ) const {
 }
 
 void Blue::printPulls( std::ostream& ost ) const {
-  printVector( m_pulls, "Pulls:", ost );
+  printVector( getPulls(), "Pulls:", ost );
   return;
 }
+void Blue::printJackknife( const jackknife_t& jackknife,
+			   std::ostream& ost ) const {
+  const vector<string>& names= m_parser.getNames();
+  const vector<string>& uniquegroups= m_parser.getUniqueGroups();
+  ost << "\nLeave-one-out combinations:" << std::endl;
+  ost << std::setw( 11 ) << "Removed:";
+  for( size_t iavg= 0; iavg < uniquegroups.size(); iavg++ ) {
+    string txt= "Average";
+    if( uniquegroups.size() > 1 ) txt+= " " + uniquegroups[iavg];
+    ost << " " << std::setw( 10 ) << txt << " " << std::setw( 10 ) 
+	<< "Error";
+  }
+  ost << " " << std::setw( 10 ) << "Chi^2" << std::endl;
+  ost.precision( 4 );
+  ost.setf( std::ios_base::fixed );
+  for( size_t ivar= 0; ivar < names.size(); ivar++ ) {
+    ost << std::setw( 11 ) << names[ivar]+":";
+    if( not jackknife.valid[ivar] ) {
+      ost << " group without measurements" << std::endl;
+      continue;
+    }
+    for( size_t iavg= 0; iavg < uniquegroups.size(); iavg++ ) {
+      ost << " " << std::setw( 10 ) << jackknife.averages(ivar,iavg)
+	  << " " << std::setw( 10 ) << jackknife.errors(ivar,iavg);
+    }
+    ost << " " << std::setw( 10 ) << jackknife.chisq[ivar] << std::endl;
+  }
+  return;
+}
+
 void Blue::printAverages( std::ostream& ost ) const {
-  printVector( m_average, "Average:", ost );
+  printVector( getAverage(), "Average:", ost );
   return;
 }
 void Blue::printVector( const TVectorD& vec,
@@ -193,12 +1363,13 @@ void Blue::printVector( const TVectorD& vec,
 }
 
 void Blue::printErrors( std::ostream& ost ) const {
+  const MatrixMap& errorsmap= getErrors();
   ost.precision( 4 );
   ost.setf( std::ios_base::fixed );  
-  for( MatrixMap::const_iterator mapitr= m_errorsmap.begin();
-       mapitr != m_errorsmap.end(); mapitr++ ) {
+  for( MatrixMap::const_iterator mapitr= errorsmap.begin();
+       mapitr != errorsmap.end(); mapitr++ ) {
     string errorkey= mapitr->first;
-    TMatrixD covm= mapitr->second;
+    const TMatrixDSym& covm= mapitr->second;
     ost << std::setw(11) << m_parser.stripLeadingDigits( errorkey )+":";
     Int_t navg= covm.GetNrows();
     for( Int_t iavg= 0; iavg < navg; iavg++ ) {
@@ -210,11 +1381,12 @@ void Blue::printErrors( std::ostream& ost ) const {
 }
 
 void Blue::printCorrelations( std::ostream& ost ) const {
-  vector<string> uniquegroups= m_parser.getUniqueGroups();
+  const vector<string>& uniquegroups= m_parser.getUniqueGroups();
   size_t navg= uniquegroups.size();
   if( navg > 1 ) {
-    MatrixMap::const_iterator totitr= m_errorsmap.find( "total" );
-    if( totitr == m_errorsmap.end() ) {
+    const MatrixMap& errorsmap= getErrors();
+    MatrixMap::const_iterator totitr= errorsmap.find( "total" );
+    if( totitr == errorsmap.end() ) {
       ost << "Total covariance matrix not found" << std::endl;
       return;
     }
@@ -11,49 +11,154 @@
 
 // C++ includes
 #include <string>
+#include <vector>
+#include <utility>
+#include <map>
 #include <iostream>
 
 // ROOT includes
 #include "TVectorD.h"
 #include "TMatrixD.h"
 #include "TMatrixDSym.h"
+#include "TDecompChol.h"
+
+// Results for a batch of value vectors combined with the same
+// covariances, one column or element per value vector:
+struct batch_t {
+  TMatrixD averages;
+  TVectorD chisq;
+  TMatrixD pulls;
+};
+
+// Leave-one-out combinations, row i has measurement i removed, valid[i]
+// is false when the removal leaves a group without measurements or the
+// reduced covariance matrix is not positive definite:
+struct jackknife_t {
+  TMatrixD averages;
+  TMatrixD errors;
+  TVectorD chisq;
+  std::vector<bool> valid;
+};
+
+// Derivatives of the averages and their total errors, element (a,i) of
+// values is d average_a / d value_i, i.e. the weights, and of the
+// matrices per error source d average_a / d error_i and 
+// d error(average_a) / d error_i:
+struct sensitivity_t {
+  TMatrixD values;
+  std::map<std::string,TMatrixD> averages;
+  std::map<std::string,TMatrixD> errors;
+};
+
+// Error source for a correlation scan: the correlations of the listed 
+// pairs of measurement indices, or of all pairs if none are given, are
+// set to each value in rhos:
+struct corrscan_t {
+  std::string errorkey;
+  TVectorD rhos;
+  std::vector< std::pair<Int_t,Int_t> > pairs;
+};
+
+// Correlation scan results, one row per grid point with the correlation
+// of each scanned source in rhos, valid is false when the total 
+// covariance is not positive definite at that point:
+struct scan_t {
+  TMatrixD rhos;
+  TMatrixD averages;
+  TMatrixD errors;
+  TVectorD chisq;
+  std::vector<bool> valid;
+};
 
 class Blue {
 
 public:
 
   Blue( const std::string& filename );
+  Blue( const AverageDataParser& parser );
   virtual ~Blue();  
-  TMatrixD getWeightsMatrix() const;
-  TVectorD getAverage() const;
+  const TMatrixD& getWeightsMatrix() const;
+  const TVectorD& getAverage() const;
   Double_t getChisq() const;
-  TVectorD getPulls() const;
-  MatrixMap getErrors() const;
+  const TVectorD& getPulls() const;
+  const MatrixMap& getErrors() const;
+  TVectorD getTotalErrors() const;
+  batch_t combineBatch( const TMatrixD& values ) const;
+  jackknife_t jackknife() const;
+  sensitivity_t getSensitivities( unsigned nthreads=0 ) const;
+  scan_t scanCorrelation( const std::string& errorkey, const TVectorD& rhos,
+			  const std::vector< std::pair<Int_t,Int_t> >& pairs=
+			  std::vector< std::pair<Int_t,Int_t> >(),
+			  unsigned nthreads=0 ) const;
+  scan_t scanCorrelations( const std::vector<corrscan_t>& sources,
+			   unsigned nthreads=0 ) const;
+  const TMatrixD& getCholeskyFactor() const;
+  const AverageDataParser& getParser() const;
+  const std::vector< std::vector<Int_t> >& getBlocks() const;
+  void setValue( Int_t ivar, Double_t value );
+  void setError( const std::string& errorkey, Int_t ivar, Double_t error );
+  void addErrorSource( const std::string& errorkey, const TVectorD& errors,
+		       const std::string& covopt, 
+		       const std::string& correlations= "" );
+  void removeErrorSource( const std::string& errorkey );
+  void setCorrelation( const std::string& errorkey, Int_t ivar, Int_t jvar,
+		       Double_t correlation );
+  void addMeasurement( const std::string& name, Double_t value,
+		       const ValueMap& errors,
+		       const StringMap& correlations= StringMap(),
+		       const std::string& group= "a" );
+  void removeMeasurement( Int_t ivar );
   void printInputs( std::ostream& ost= std::cout ) const;
   void printResults( std::ostream& ost= std::cout ) const;
   void printChisq( std::ostream& ost= std::cout ) const;
   void printWeights( std::ostream& ost= std::cout ) const;
   void printPulls( std::ostream& ost= std::cout ) const;
+  void printJackknife( const jackknife_t& jackknife, 
+		       std::ostream& ost= std::cout ) const;
   void printAverages( std::ostream& ost= std::cout ) const;
   void printErrors( std::ostream& ost= std::cout ) const;
   void printCorrelations( std::ostream& ost= std::cout ) const;
 
 private:
 
-  void calcWeightsMatrix();
-  void calcAverage();
-  void calcChisq();
-  void calcPulls();
-  void errorAnalysis();
+  // Results are calculated on first access and cached, the bits of
+  // m_valid mark the cached results which are up to date:
+  enum Result { kFactor=1, kWeights=2, kAverage=4, kChisq=8, kPulls=16, 
+		kErrors=32, kCholesky=64 };
+  void invalidate( unsigned results ) const;
+  const TMatrixD& getDenseFactor() const;
+  void factorise() const;
+  bool factoriseWoodbury() const;
+  void updatedDenseFactor() const;
+  void updateDenseFactor( Int_t ivar, const TVectorD& column );
+  bool hasGlobalSources() const;
+  jackknife_t recombineJackknife() const;
+  void solve( TMatrixD& bmatrix ) const;
+  void solve( TVectorD& bvector ) const;
+  void calcWeightsMatrix() const;
+  void calcAverage() const;
+  void calcChisq() const;
+  void calcPulls() const;
+  void errorAnalysis() const;
   void printVector( const TVectorD& vec, const std::string& txt,
 		    std::ostream& ost= std::cout ) const;
   AverageDataParser m_parser;
-  TMatrixDSym m_invm;
-  TMatrixD m_weightsmatrix;
-  TVectorD m_average;
-  Double_t m_chisq;
-  TVectorD m_pulls;
-  MatrixMap m_errorsmap;
+  mutable unsigned m_valid;
+  enum SolveMethod { kDenseCholesky, kWoodbury, kBlockCholesky };
+  mutable SolveMethod m_method;
+  mutable std::vector< std::vector<Int_t> > m_blocks;
+  mutable std::vector<TDecompChol> m_blockchols;
+  mutable TVectorD m_diaginv;
+  mutable TMatrixD m_lowrank;
+  mutable TMatrixD m_dinvlowrank;
+  mutable TDecompChol m_capacitance;
+  mutable TMatrixD m_upper;
+  mutable TMatrixD m_weightsmatrix;
+  mutable TMatrixDSym m_avgcov;
+  mutable TVectorD m_average;
+  mutable Double_t m_chisq;
+  mutable TVectorD m_pulls;
+  mutable MatrixMap m_errorsmap;
 
 };
 
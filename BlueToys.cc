@@ -0,0 +1,242 @@
+
+#include "BlueToys.hh"
+#include "Parallel.hh"
+
+#include <vector>
+#include <cmath>
+#include <iomanip>
+#include <algorithm>
+
+#include "TMath.h"
+#include "TRandom3.h"
+
+using std::string;
+using std::vector;
+
+// Toys per block with its own random number seed:
+static const Long64_t toysPerBlock= 1000;
+
+// Moments with Welford's update and Chan's merge:
+ToyMoments::ToyMoments() : m_n( 0 ), m_mean( 0.0 ), m_m2( 0.0 ) {}
+void ToyMoments::add( Double_t x ) {
+  m_n++;
+  Double_t delta= x - m_mean;
+  m_mean+= delta/Double_t( m_n );
+  m_m2+= delta*( x - m_mean );
+  return;
+}
+void ToyMoments::merge( const ToyMoments& other ) {
+  if( other.m_n == 0 ) return;
+  Long64_t n= m_n + other.m_n;
+  Double_t delta= other.m_mean - m_mean;
+  m_mean+= delta*Double_t( other.m_n )/Double_t( n );
+  m_m2+= other.m_m2 + delta*delta*Double_t( m_n )*Double_t( other.m_n )/
+    Double_t( n );
+  m_n= n;
+  return;
+}
+Double_t ToyMoments::getVariance() const {
+  return m_n > 1 ? m_m2/Double_t( m_n - 1 ) : 0.0;
+}
+Double_t ToyMoments::getRms() const {
+  return sqrt( getVariance() );
+}
+
+ToyHistogram::ToyHistogram( Int_t nbins, Double_t low, Double_t high ) :
+  m_nbins( nbins ), m_low( low ), m_high( high ), m_bins( nbins+2, 0 ) {}
+void ToyHistogram::fill( Double_t x ) {
+  Int_t ibin;
+  if( x < m_low ) ibin= 0;
+  else if( x >= m_high ) ibin= m_nbins+1;
+  else ibin= 1 + Int_t( m_nbins*( x - m_low )/( m_high - m_low ) );
+  m_bins[ibin]++;
+  return;
+}
+void ToyHistogram::merge( const ToyHistogram& other ) {
+  for( size_t ibin= 0; ibin < m_bins.size(); ibin++ ) {
+    m_bins[ibin]+= other.m_bins.at( ibin );
+  }
+  return;
+}
+Double_t ToyHistogram::getLowEdge( Int_t ibin ) const {
+  return m_low + ( ibin - 1 )*( m_high - m_low )/Double_t( m_nbins );
+}
+
+ToyResults::ToyResults( Int_t navg, Int_t nvar, Int_t nbinsprob ) :
+  avgmoments( navg ), pullmoments( nvar ), ncovered( navg, 0 ),
+  prob( nbinsprob, 0.0, 1.0 ) {}
+void ToyResults::merge( const ToyResults& other ) {
+  for( size_t iavg= 0; iavg < avgmoments.size(); iavg++ ) {
+    avgmoments[iavg].merge( other.avgmoments[iavg] );
+    ncovered[iavg]+= other.ncovered[iavg];
+  }
+  for( size_t ivar= 0; ivar < pullmoments.size(); ivar++ ) {
+    pullmoments[ivar].merge( other.pullmoments[ivar] );
+  }
+  chisq.merge( other.chisq );
+  prob.merge( other.prob );
+  return;
+}
+
+// Ctor takes everything needed from the Blue object, generating toys
+// then only reads the copies:
+BlueToys::BlueToys( const Blue& blue, Int_t nbinsprob ) :
+  m_averages( blue.getAverage() ),
+  m_weightsmatrix( blue.getWeightsMatrix() ),
+  m_totalerrors( blue.getParser().getTotalErrors() ),
+  m_nbinsprob( nbinsprob ) {
+  const GroupMap& groups= blue.getParser().getGroupMap();
+  Int_t nvar= groups.getNvar();
+  Int_t navg= groups.getNgroups();
+  m_ndof= nvar - navg;
+  m_truth.ResizeTo( nvar );
+  m_truth= groups.expand( m_averages );
+  m_groupindex= groups.getIndices();
+  m_avgerrors.ResizeTo( navg );
+  m_avgerrors= blue.getTotalErrors();
+  // Transpose of U, row i holds the lower triangle L(i,0...i):
+  const TMatrixD& upper= blue.getCholeskyFactor();
+  m_lower.ResizeTo( nvar, nvar );
+  m_lower= TMatrixD( TMatrixD::kTransposed, upper );
+  m_results= ToyResults( navg, nvar, m_nbinsprob );
+}
+
+// Generate and combine one toy, work holds 2*nvar + navg doubles:
+void BlueToys::generateToy( TRandom3& rndm, vector<Double_t>& work,
+			    ToyResults& results ) const {
+  Int_t nvar= m_truth.GetNoElements();
+  Int_t navg= m_averages.GetNoElements();
+  const Double_t* lower= m_lower.GetMatrixArray();
+  const Double_t* weights= m_weightsmatrix.GetMatrixArray();
+  Double_t* z= &work[0];
+  Double_t* x= z + nvar;
+  Double_t* avg= x + nvar;
+  for( Int_t ivar= 0; ivar < nvar; ivar++ ) z[ivar]= rndm.Gaus( 0.0, 1.0 );
+  for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+    const Double_t* row= lower + ivar*nvar;
+    Double_t sum= m_truth[ivar];
+    for( Int_t k= 0; k <= ivar; k++ ) sum+= row[k]*z[k];
+    x[ivar]= sum;
+  }
+  for( Int_t iavg= 0; iavg < navg; iavg++ ) {
+    const Double_t* row= weights + iavg*nvar;
+    Double_t sum= 0.0;
+    for( Int_t ivar= 0; ivar < nvar; ivar++ ) sum+= row[ivar]*x[ivar];
+    avg[iavg]= sum;
+    results.avgmoments[iavg].add( sum );
+    if( fabs( sum - m_averages[iavg] ) <= m_avgerrors[iavg] ) {
+      results.ncovered[iavg]++;
+    }
+  }
+  // Residuals and pulls, then chi^2= |L^-1 delta|^2 by forward 
+  // substitution into z:
+  for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+    x[ivar]-= avg[m_groupindex[ivar]];
+    results.pullmoments[ivar].add( x[ivar]/m_totalerrors[ivar] );
+  }
+  Double_t chisq= 0.0;
+  for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+    const Double_t* row= lower + ivar*nvar;
+    Double_t sum= x[ivar];
+    for( Int_t k= 0; k < ivar; k++ ) sum-= row[k]*z[k];
+    z[ivar]= sum/row[ivar];
+    chisq+= z[ivar]*z[ivar];
+  }
+  results.chisq.add( chisq );
+  results.prob.fill( TMath::Prob( chisq, m_ndof ) );
+  return;
+}
+
+// Seed for a block of toys from the user seed and the block number,
+// splitmix64 finaliser; TRandom3 treats seed 0 as "random":
+static UInt_t blockSeed( UInt_t seed, Long64_t iblock ) {
+  ULong64_t z= ( ULong64_t( seed ) << 32 ) + ULong64_t( iblock ) + 
+    0x9e3779b97f4a7c15ULL;
+  z= ( z ^ ( z >> 30 ) )*0xbf58476d1ce4e5b9ULL;
+  z= ( z ^ ( z >> 27 ) )*0x94d049bb133111ebULL;
+  z= z ^ ( z >> 31 );
+  UInt_t blockseed= UInt_t( z );
+  return blockseed != 0 ? blockseed : 1;
+}
+
+// Task for parallelFor, one index per block of toys:
+class ToyBlock: public ParallelTask {
+public:
+  ToyBlock( const BlueToys& toys, vector<ToyResults>& results,
+	    Long64_t ntoys, UInt_t seed ) :
+    m_toys( toys ), m_results( results ), m_ntoys( ntoys ), m_seed( seed ) {}
+  void operator()( size_t iblock, unsigned ithread ) {
+    Int_t nvar= m_toys.m_truth.GetNoElements();
+    Int_t navg= m_toys.m_averages.GetNoElements();
+    vector<Double_t> work( 2*nvar + navg );
+    TRandom3 rndm( blockSeed( m_seed, iblock ) );
+    Long64_t first= iblock*toysPerBlock;
+    Long64_t last= std::min( first + toysPerBlock, m_ntoys );
+    for( Long64_t itoy= first; itoy < last; itoy++ ) {
+      m_toys.generateToy( rndm, work, m_results[ithread] );
+    }
+  }
+private:
+  const BlueToys& m_toys;
+  vector<ToyResults>& m_results;
+  Long64_t m_ntoys;
+  UInt_t m_seed;
+};
+
+void BlueToys::generate( Long64_t ntoys, UInt_t seed, unsigned nthreads ) {
+  if( nthreads == 0 ) nthreads= defaultThreads();
+  Int_t nvar= m_truth.GetNoElements();
+  Int_t navg= m_averages.GetNoElements();
+  vector<ToyResults> results( nthreads, 
+			      ToyResults( navg, nvar, m_nbinsprob ) );
+  ToyBlock task( *this, results, ntoys, seed );
+  size_t nblocks= ( ntoys + toysPerBlock - 1 )/toysPerBlock;
+  parallelFor( nblocks, task, nthreads );
+  m_results= ToyResults( navg, nvar, m_nbinsprob );
+  for( unsigned ithread= 0; ithread < nthreads; ithread++ ) {
+    m_results.merge( results[ithread] );
+  }
+  return;
+}
+
+// Getters:
+const ToyMoments& BlueToys::getAverageMoments( Int_t iavg ) const {
+  return m_results.avgmoments.at( iavg );
+}
+const ToyMoments& BlueToys::getPullMoments( Int_t ivar ) const {
+  return m_results.pullmoments.at( ivar );
+}
+Double_t BlueToys::getCoverage( Int_t iavg ) const {
+  Long64_t ntoys= getNtoys();
+  return ntoys > 0 ? 
+    Double_t( m_results.ncovered.at( iavg ) )/Double_t( ntoys ) : 0.0;
+}
+
+void BlueToys::printResults( std::ostream& ost ) const {
+  ost << "\nBlue toys: " << getNtoys() << " pseudo-experiments\n" 
+      << std::endl;
+  ost.precision( 4 );
+  ost.setf( std::ios_base::fixed );
+  for( size_t iavg= 0; iavg < m_results.avgmoments.size(); iavg++ ) {
+    const ToyMoments& moments= m_results.avgmoments[iavg];
+    ost << "Average " << iavg << ": mean " << std::setw( 10 ) 
+	<< moments.getMean() << " bias " << std::setw( 10 ) 
+	<< moments.getMean() - m_averages[iavg] << " rms " 
+	<< std::setw( 10 ) << moments.getRms() << " error " 
+	<< std::setw( 10 ) << m_avgerrors[iavg] << " coverage " 
+	<< getCoverage( iavg ) << std::endl;
+  }
+  ost << std::setw( 11 ) << "Pull means:";
+  for( size_t ivar= 0; ivar < m_results.pullmoments.size(); ivar++ ) {
+    ost << " " << std::setw( 10 ) << m_results.pullmoments[ivar].getMean();
+  }
+  ost << std::endl;
+  ost << std::setw( 11 ) << "Pull rms:";
+  for( size_t ivar= 0; ivar < m_results.pullmoments.size(); ivar++ ) {
+    ost << " " << std::setw( 10 ) << m_results.pullmoments[ivar].getRms();
+  }
+  ost << std::endl;
+  ost << "Chi^2 mean " << m_results.chisq.getMean() << " for " << m_ndof 
+      << " d.o.f." << std::endl;
+  return;
+}
@@ -0,0 +1,102 @@
+#ifndef BLUETOYS_HH
+#define BLUETOYS_HH
+
+#include "Blue.hh"
+
+#include <vector>
+#include <iostream>
+
+#include "Rtypes.h"
+#include "TVectorD.h"
+#include "TMatrixD.h"
+
+class TRandom3;
+
+// Running mean and variance of a toy quantity, mergeable across threads:
+class ToyMoments {
+public:
+  ToyMoments();
+  void add( Double_t x );
+  void merge( const ToyMoments& other );
+  Long64_t getN() const { return m_n; }
+  Double_t getMean() const { return m_mean; }
+  Double_t getVariance() const;
+  Double_t getRms() const;
+private:
+  Long64_t m_n;
+  Double_t m_mean;
+  Double_t m_m2;
+};
+
+// Fixed binning histogram with under- and overflow in bins 0 and nbins+1:
+class ToyHistogram {
+public:
+  ToyHistogram( Int_t nbins=20, Double_t low=0.0, Double_t high=1.0 );
+  void fill( Double_t x );
+  void merge( const ToyHistogram& other );
+  Int_t getNbins() const { return m_nbins; }
+  Double_t getLowEdge( Int_t ibin ) const;
+  Long64_t getBinContent( Int_t ibin ) const { return m_bins.at( ibin ); }
+private:
+  Int_t m_nbins;
+  Double_t m_low;
+  Double_t m_high;
+  std::vector<Long64_t> m_bins;
+};
+
+// Toy distributions accumulated by one thread or merged over threads:
+class ToyResults {
+public:
+  ToyResults( Int_t navg=0, Int_t nvar=0, Int_t nbinsprob=20 );
+  void merge( const ToyResults& other );
+  std::vector<ToyMoments> avgmoments;
+  std::vector<ToyMoments> pullmoments;
+  std::vector<Long64_t> ncovered;
+  ToyMoments chisq;
+  ToyHistogram prob;
+};
+
+// Pseudo-experiments for a Blue combination: toy values are generated
+// around the combined averages from the Cholesky factor of the total 
+// covariance, x= G*average + U^T z with z standard normal, and combined
+// with the weights of the Blue object. Toys are only accumulated
+// into moments and histograms, they are not stored:
+class BlueToys {
+
+public:
+
+  BlueToys( const Blue& blue, Int_t nbinsprob=20 );
+
+  // Toys are generated in blocks with seeds derived from seed and the
+  // block number, the same toys are made for any number of threads:
+  void generate( Long64_t ntoys, UInt_t seed=4357, unsigned nthreads=0 );
+
+  Long64_t getNtoys() const { return m_results.chisq.getN(); }
+  const ToyMoments& getAverageMoments( Int_t iavg ) const;
+  const ToyMoments& getPullMoments( Int_t ivar ) const;
+  const ToyMoments& getChisqMoments() const { return m_results.chisq; }
+  const ToyHistogram& getProbHistogram() const { return m_results.prob; }
+  Double_t getCoverage( Int_t iavg ) const;
+  void printResults( std::ostream& ost= std::cout ) const;
+
+private:
+
+  friend class ToyBlock;
+
+  void generateToy( TRandom3& rndm, std::vector<Double_t>& work,
+		    ToyResults& results ) const;
+
+  TVectorD m_truth;
+  TVectorD m_averages;
+  TVectorD m_avgerrors;
+  TMatrixD m_lower;
+  TMatrixD m_weightsmatrix;
+  std::vector<Int_t> m_groupindex;
+  TVectorD m_totalerrors;
+  Int_t m_ndof;
+  Int_t m_nbinsprob;
+  ToyResults m_results;
+
+};
+
+#endif
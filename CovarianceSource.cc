@@ -0,0 +1,111 @@
+
+#include "CovarianceSource.hh"
+#include "LinearAlgebra.hh"
+
+#include <vector>
+
+// Ctors:
+CovarianceSource::CovarianceSource( Int_t ndim ) :
+  m_ndim( ndim ), m_isdense( false ), m_diagonal( ndim ), m_sign( 1.0 ) {}
+
+CovarianceSource::CovarianceSource( const TVectorD& diagonal ) :
+  m_ndim( diagonal.GetNoElements() ), m_isdense( false ), 
+  m_diagonal( diagonal ), m_sign( 1.0 ) {}
+
+CovarianceSource::CovarianceSource( const TVectorD& diagonal,
+				    const TVectorD& vector, 
+				    Double_t sign ) :
+  m_ndim( diagonal.GetNoElements() ), m_isdense( false ), 
+  m_diagonal( diagonal ), m_vector( vector ), m_sign( sign ) {}
+
+CovarianceSource::CovarianceSource( const TMatrixDSym& matrix ) :
+  m_ndim( matrix.GetNrows() ), m_isdense( true ), m_sign( 1.0 ),
+  m_matrix( matrix ) {}
+
+// ROOT vectors and matrices only assign between equal sizes:
+CovarianceSource& CovarianceSource::operator=( const CovarianceSource& other ) {
+  if( this != &other ) {
+    m_ndim= other.m_ndim;
+    m_isdense= other.m_isdense;
+    m_diagonal.ResizeTo( other.m_diagonal );
+    m_diagonal= other.m_diagonal;
+    m_vector.ResizeTo( other.m_vector );
+    m_vector= other.m_vector;
+    m_sign= other.m_sign;
+    m_matrix.ResizeTo( other.m_matrix );
+    m_matrix= other.m_matrix;
+  }
+  return *this;
+}
+
+// Elements:
+Double_t CovarianceSource::operator()( Int_t ierr, Int_t jerr ) const {
+  if( m_isdense ) return m_matrix(ierr,jerr);
+  Double_t cov= 0.0;
+  if( ierr == jerr ) cov= m_diagonal[ierr];
+  if( hasRankOne() ) cov+= m_sign*m_vector[ierr]*m_vector[jerr];
+  return cov;
+}
+
+// Dense matrix:
+TMatrixDSym CovarianceSource::getMatrix() const {
+  if( m_isdense ) return m_matrix;
+  TMatrixDSym matrix( m_ndim );
+  addTo( matrix );
+  return matrix;
+}
+
+// Add to a dense matrix, O(N) for diagonal sources:
+void CovarianceSource::addTo( TMatrixDSym& total ) const {
+  if( m_isdense ) {
+    total+= m_matrix;
+    return;
+  }
+  for( Int_t ierr= 0; ierr < m_ndim; ierr++ ) {
+    total(ierr,ierr)+= m_diagonal[ierr];
+  }
+  if( hasRankOne() ) {
+    for( Int_t ierr= 0; ierr < m_ndim; ierr++ ) {
+      Double_t vi= m_sign*m_vector[ierr];
+      for( Int_t jerr= 0; jerr < m_ndim; jerr++ ) {
+	total(ierr,jerr)+= vi*m_vector[jerr];
+      }
+    }
+  }
+  return;
+}
+
+// W C W^T, O(M*N) for compact sources W D W^T + sign (W r) (W r)^T
+// in one pass over the rows of W, dense ones go to the linear algebra
+// backend:
+TMatrixDSym CovarianceSource::similarity( const TMatrixD& weightsmatrix ) 
+  const {
+  if( m_isdense ) {
+    return getLinearAlgebra().similarity( weightsmatrix, m_matrix );
+  }
+  Int_t navg= weightsmatrix.GetNrows();
+  TMatrixDSym result( navg );
+  const Double_t* weights= weightsmatrix.GetMatrixArray();
+  std::vector<Double_t> wvector( navg );
+  for( Int_t iavg= 0; iavg < navg; iavg++ ) {
+    const Double_t* wrow= weights + iavg*m_ndim;
+    if( hasRankOne() ) {
+      Double_t sum= 0.0;
+      for( Int_t ierr= 0; ierr < m_ndim; ierr++ ) {
+	sum+= wrow[ierr]*m_vector[ierr];
+      }
+      wvector[iavg]= sum;
+    }
+    for( Int_t javg= 0; javg <= iavg; javg++ ) {
+      const Double_t* wrowj= weights + javg*m_ndim;
+      Double_t sum= 0.0;
+      for( Int_t ierr= 0; ierr < m_ndim; ierr++ ) {
+	sum+= wrowj[ierr]*m_diagonal[ierr]*wrow[ierr];
+      }
+      if( hasRankOne() ) sum+= m_sign*wvector[iavg]*wvector[javg];
+      result(iavg,javg)= sum;
+      result(javg,iavg)= sum;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,56 @@
+#ifndef COVARIANCESOURCE_HH
+#define COVARIANCESOURCE_HH
+
+#include <string>
+#include <map>
+
+#include "TVectorD.h"
+#include "TMatrixD.h"
+#include "TMatrixDSym.h"
+
+// Covariance matrix of one error source, kept in compact form where the
+// covariance option allows it: a diagonal D plus a rank-one term
+// sign*r*r^T covers options u (D), f (r*r^T), a (2D - r*r^T), gp and gpr
+// (D + r*r^T). Other options keep the dense matrix. The dense matrix is
+// only made on request:
+class CovarianceSource {
+
+public:
+
+  // Zero matrix:
+  CovarianceSource( Int_t ndim=0 );
+  // Diagonal:
+  CovarianceSource( const TVectorD& diagonal );
+  // Diagonal plus rank-one term:
+  CovarianceSource( const TVectorD& diagonal, const TVectorD& vector,
+		    Double_t sign=1.0 );
+  // Dense:
+  CovarianceSource( const TMatrixDSym& matrix );
+  CovarianceSource& operator=( const CovarianceSource& other );
+
+  bool isDense() const { return m_isdense; }
+  bool hasRankOne() const { return m_vector.GetNoElements() > 0; }
+  Int_t getNrows() const { return m_ndim; }
+  const TVectorD& getDiagonal() const { return m_diagonal; }
+  const TVectorD& getVector() const { return m_vector; }
+  Double_t getSign() const { return m_sign; }
+  const TMatrixDSym& getDenseMatrix() const { return m_matrix; }
+  Double_t operator()( Int_t ierr, Int_t jerr ) const;
+  TMatrixDSym getMatrix() const;
+  void addTo( TMatrixDSym& total ) const;
+  TMatrixDSym similarity( const TMatrixD& weightsmatrix ) const;
+
+private:
+
+  Int_t m_ndim;
+  bool m_isdense;
+  TVectorD m_diagonal;
+  TVectorD m_vector;
+  Double_t m_sign;
+  TMatrixDSym m_matrix;
+
+};
+
+typedef std::map<std::string,CovarianceSource> CovarianceMap;
+
+#endif
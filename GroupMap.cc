@@ -0,0 +1,60 @@
+
+#include "GroupMap.hh"
+
+GroupMap::GroupMap( Int_t ngroups, const std::vector<Int_t>& indices ) :
+  m_ngroups( ngroups ), m_indices( indices ) {}
+
+std::vector<Int_t> GroupMap::getGroupSizes() const {
+  std::vector<Int_t> sizes( m_ngroups, 0 );
+  for( size_t ivar= 0; ivar < m_indices.size(); ivar++ ) {
+    sizes[m_indices[ivar]]++;
+  }
+  return sizes;
+}
+
+// Dense G, only for solves which need the columns explicitly:
+TMatrixD GroupMap::getMatrix() const {
+  TMatrixD matrix( getNvar(), m_ngroups );
+  for( Int_t ivar= 0; ivar < getNvar(); ivar++ ) {
+    matrix(ivar,m_indices[ivar])= 1.0;
+  }
+  return matrix;
+}
+
+TVectorD GroupMap::expand( const TVectorD& averages ) const {
+  TVectorD result( getNvar() );
+  for( Int_t ivar= 0; ivar < getNvar(); ivar++ ) {
+    result[ivar]= averages[m_indices[ivar]];
+  }
+  return result;
+}
+TMatrixD GroupMap::expand( const TMatrixD& averages ) const {
+  Int_t ncols= averages.GetNcols();
+  TMatrixD result( getNvar(), ncols );
+  for( Int_t ivar= 0; ivar < getNvar(); ivar++ ) {
+    Int_t igroup= m_indices[ivar];
+    for( Int_t icol= 0; icol < ncols; icol++ ) {
+      result(ivar,icol)= averages(igroup,icol);
+    }
+  }
+  return result;
+}
+
+TVectorD GroupMap::sum( const TVectorD& values ) const {
+  TVectorD result( m_ngroups );
+  for( Int_t ivar= 0; ivar < getNvar(); ivar++ ) {
+    result[m_indices[ivar]]+= values[ivar];
+  }
+  return result;
+}
+TMatrixD GroupMap::sum( const TMatrixD& values ) const {
+  Int_t ncols= values.GetNcols();
+  TMatrixD result( m_ngroups, ncols );
+  for( Int_t ivar= 0; ivar < getNvar(); ivar++ ) {
+    Int_t igroup= m_indices[ivar];
+    for( Int_t icol= 0; icol < ncols; icol++ ) {
+      result(igroup,icol)+= values(ivar,icol);
+    }
+  }
+  return result;
+}
@@ -0,0 +1,39 @@
+#ifndef GROUPMAP_HH
+#define GROUPMAP_HH
+
+#include <vector>
+
+#include "TVectorD.h"
+#include "TMatrixD.h"
+
+// Assignment of N measurements to M groups as index vector, replaces
+// products with the dense N x M 0/1 group matrix G by gather and scatter
+// loops of O(N) per column:
+class GroupMap {
+
+public:
+
+  GroupMap( Int_t ngroups=0, 
+	    const std::vector<Int_t>& indices= std::vector<Int_t>() );
+
+  Int_t getNgroups() const { return m_ngroups; }
+  Int_t getNvar() const { return m_indices.size(); }
+  Int_t operator[]( Int_t ivar ) const { return m_indices[ivar]; }
+  const std::vector<Int_t>& getIndices() const { return m_indices; }
+  std::vector<Int_t> getGroupSizes() const;
+  TMatrixD getMatrix() const;
+  // G a and G A, i.e. average of its group for each measurement:
+  TVectorD expand( const TVectorD& averages ) const;
+  TMatrixD expand( const TMatrixD& averages ) const;
+  // G^T x and G^T X, i.e. sums over the measurements of each group:
+  TVectorD sum( const TVectorD& values ) const;
+  TMatrixD sum( const TMatrixD& values ) const;
+
+private:
+
+  Int_t m_ngroups;
+  std::vector<Int_t> m_indices;
+
+};
+
+#endif
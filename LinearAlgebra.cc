@@ -0,0 +1,221 @@
+#include "LinearAlgebra.hh"
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "TDecompChol.h"
+
+// ROOT reference implementation, substitutions and similarity work on
+// the row-major arrays:
+class RootLinearAlgebra: public LinearAlgebra {
+public:
+  virtual std::string getName() const { return "root"; }
+  virtual bool cholesky( const TMatrixDSym& matrix, TMatrixD& upper ) const {
+    TDecompChol chol( matrix );
+    if( not chol.Decompose() ) return false;
+    const TMatrixD& cholupper= chol.GetU();
+    upper.ResizeTo( cholupper );
+    upper= cholupper;
+    for( Int_t irow= 0; irow < upper.GetNrows(); irow++ ) {
+      for( Int_t icol= 0; icol < irow; icol++ ) upper(irow,icol)= 0.0;
+    }
+    return true;
+  }
+  // U^T Y= B then U X= Y, whole rows of B at a time:
+  virtual void choleskySolve( const TMatrixD& upper,
+			      TMatrixD& bmatrix ) const {
+    Int_t nvar= upper.GetNrows();
+    Int_t ncol= bmatrix.GetNcols();
+    const Double_t* u= upper.GetMatrixArray();
+    Double_t* b= bmatrix.GetMatrixArray();
+    for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+      Double_t* brow= b + ivar*ncol;
+      for( Int_t jvar= 0; jvar < ivar; jvar++ ) {
+	Double_t factor= u[jvar*nvar+ivar];
+	const Double_t* bjrow= b + jvar*ncol;
+	for( Int_t icol= 0; icol < ncol; icol++ ) {
+	  brow[icol]-= factor*bjrow[icol];
+	}
+      }
+      Double_t diagonal= u[ivar*nvar+ivar];
+      for( Int_t icol= 0; icol < ncol; icol++ ) brow[icol]/= diagonal;
+    }
+    for( Int_t ivar= nvar-1; ivar >= 0; ivar-- ) {
+      Double_t* brow= b + ivar*ncol;
+      const Double_t* urow= u + ivar*nvar;
+      for( Int_t jvar= ivar+1; jvar < nvar; jvar++ ) {
+	const Double_t* bjrow= b + jvar*ncol;
+	for( Int_t icol= 0; icol < ncol; icol++ ) {
+	  brow[icol]-= urow[jvar]*bjrow[icol];
+	}
+      }
+      for( Int_t icol= 0; icol < ncol; icol++ ) brow[icol]/= urow[ivar];
+    }
+    return;
+  }
+  // One pass over the rows of W with A w_a formed row by row:
+  virtual TMatrixDSym similarity( const TMatrixD& weightsmatrix,
+				  const TMatrixDSym& matrix ) const {
+    Int_t navg= weightsmatrix.GetNrows();
+    Int_t nvar= matrix.GetNrows();
+    TMatrixDSym result( navg );
+    const Double_t* weights= weightsmatrix.GetMatrixArray();
+    const Double_t* cov= matrix.GetMatrixArray();
+    std::vector<Double_t> cw( nvar );
+    for( Int_t iavg= 0; iavg < navg; iavg++ ) {
+      const Double_t* wrow= weights + iavg*nvar;
+      for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+	const Double_t* covrow= cov + ivar*nvar;
+	Double_t sum= 0.0;
+	for( Int_t jvar= 0; jvar < nvar; jvar++ ) sum+= covrow[jvar]*wrow[jvar];
+	cw[ivar]= sum;
+      }
+      for( Int_t javg= 0; javg <= iavg; javg++ ) {
+	const Double_t* wrowj= weights + javg*nvar;
+	Double_t sum= 0.0;
+	for( Int_t ivar= 0; ivar < nvar; ivar++ ) sum+= wrowj[ivar]*cw[ivar];
+	result(iavg,javg)= sum;
+	result(javg,iavg)= sum;
+      }
+    }
+    return result;
+  }
+  virtual void multiply( const TMatrixD& amatrix, const TMatrixD& bmatrix,
+			 TMatrixD& result ) const {
+    result.Mult( amatrix, bmatrix );
+    return;
+  }
+};
+
+#ifdef AVERAGETOOLS_LAPACK
+
+extern "C" {
+  void dpotrf_( const char* uplo, const int* n, double* a, const int* lda,
+		int* info );
+  void dpotrs_( const char* uplo, const int* n, const int* nrhs,
+		const double* a, const int* lda, double* b, const int* ldb,
+		int* info );
+  void dsymm_( const char* side, const char* uplo, const int* m,
+	       const int* n, const double* alpha, const double* a,
+	       const int* lda, const double* b, const int* ldb,
+	       const double* beta, double* c, const int* ldc );
+  void dgemm_( const char* transa, const char* transb, const int* m,
+	       const int* n, const int* k, const double* alpha,
+	       const double* a, const int* lda, const double* b,
+	       const int* ldb, const double* beta, double* c,
+	       const int* ldc );
+}
+
+// LAPACK and BLAS are column-major, the row-major upper triangle of U is
+// the column-major lower triangle L= U^T and a row-major matrix is the
+// transpose of the same array read column-major:
+class LapackLinearAlgebra: public LinearAlgebra {
+public:
+  virtual std::string getName() const { return "lapack"; }
+  virtual bool cholesky( const TMatrixDSym& matrix, TMatrixD& upper ) const {
+    int nvar= matrix.GetNrows();
+    upper.ResizeTo( nvar, nvar );
+    if( nvar == 0 ) return true;
+    const Double_t* cov= matrix.GetMatrixArray();
+    std::copy( cov, cov+nvar*nvar, upper.GetMatrixArray() );
+    int info= 0;
+    dpotrf_( "L", &nvar, upper.GetMatrixArray(), &nvar, &info );
+    if( info != 0 ) return false;
+    for( Int_t irow= 0; irow < nvar; irow++ ) {
+      for( Int_t icol= 0; icol < irow; icol++ ) upper(irow,icol)= 0.0;
+    }
+    return true;
+  }
+  virtual void choleskySolve( const TMatrixD& upper,
+			      TMatrixD& bmatrix ) const {
+    int nvar= upper.GetNrows();
+    int ncol= bmatrix.GetNcols();
+    if( nvar == 0 or ncol == 0 ) return;
+    std::vector<Double_t> buffer( nvar*ncol );
+    for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+      for( Int_t icol= 0; icol < ncol; icol++ ) {
+	buffer[icol*nvar+ivar]= bmatrix(ivar,icol);
+      }
+    }
+    int info= 0;
+    dpotrs_( "L", &nvar, &ncol, upper.GetMatrixArray(), &nvar, &buffer[0],
+	     &nvar, &info );
+    for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+      for( Int_t icol= 0; icol < ncol; icol++ ) {
+	bmatrix(ivar,icol)= buffer[icol*nvar+ivar];
+      }
+    }
+    return;
+  }
+  // T= A W^T with dsymm, then W T with dgemm:
+  virtual TMatrixDSym similarity( const TMatrixD& weightsmatrix,
+				  const TMatrixDSym& matrix ) const {
+    int navg= weightsmatrix.GetNrows();
+    int nvar= matrix.GetNrows();
+    TMatrixDSym result( navg );
+    if( navg == 0 or nvar == 0 ) return result;
+    std::vector<Double_t> tmatrix( nvar*navg );
+    const double one= 1.0;
+    const double zero= 0.0;
+    dsymm_( "L", "U", &nvar, &navg, &one, matrix.GetMatrixArray(), &nvar,
+	    weightsmatrix.GetMatrixArray(), &nvar, &zero, &tmatrix[0],
+	    &nvar );
+    dgemm_( "T", "N", &navg, &navg, &nvar, &one,
+	    weightsmatrix.GetMatrixArray(), &nvar, &tmatrix[0], &nvar,
+	    &zero, result.GetMatrixArray(), &navg );
+    return result;
+  }
+  // C^T= B^T A^T read column-major:
+  virtual void multiply( const TMatrixD& amatrix, const TMatrixD& bmatrix,
+			 TMatrixD& result ) const {
+    int nrow= amatrix.GetNrows();
+    int ninner= amatrix.GetNcols();
+    int ncol= bmatrix.GetNcols();
+    result.Zero();
+    if( nrow == 0 or ncol == 0 or ninner == 0 ) return;
+    const double one= 1.0;
+    const double zero= 0.0;
+    dgemm_( "N", "N", &ncol, &nrow, &ninner, &one,
+	    bmatrix.GetMatrixArray(), &ncol, amatrix.GetMatrixArray(),
+	    &ninner, &zero, result.GetMatrixArray(), &ncol );
+    return;
+  }
+};
+
+#endif
+
+// Backends as function statics, safe to use during static
+// initialisation of other units:
+static LinearAlgebra& rootLinearAlgebra() {
+  static RootLinearAlgebra backend;
+  return backend;
+}
+static LinearAlgebra*& currentLinearAlgebra() {
+  static LinearAlgebra* current= &rootLinearAlgebra();
+  return current;
+}
+
+LinearAlgebra& getLinearAlgebra() {
+  return *currentLinearAlgebra();
+}
+void setLinearAlgebra( LinearAlgebra& backend ) {
+  currentLinearAlgebra()= &backend;
+  return;
+}
+void setLinearAlgebra( const std::string& name ) {
+  if( name == "root" ) {
+    setLinearAlgebra( rootLinearAlgebra() );
+  }
+#ifdef AVERAGETOOLS_LAPACK
+  else if( name == "lapack" ) {
+    static LapackLinearAlgebra backend;
+    setLinearAlgebra( backend );
+  }
+#endif
+  else {
+    throw std::invalid_argument( "linear algebra backend " + name +
+				 " not available" );
+  }
+  return;
+}
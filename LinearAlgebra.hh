@@ -0,0 +1,39 @@
+#ifndef LINEARALGEBRA_HH
+#define LINEARALGEBRA_HH
+
+#include <string>
+
+#include "TMatrixD.h"
+#include "TMatrixDSym.h"
+
+// Backend for the heavy dense matrix operations of Blue and
+// CovarianceSource. Implementations must be stateless, their methods are
+// called from several threads at once. ROOT is the default and the
+// reference, an implementation calling LAPACK and BLAS is compiled in
+// with AVERAGETOOLS_LAPACK:
+class LinearAlgebra {
+public:
+  virtual ~LinearAlgebra() {}
+  virtual std::string getName() const=0;
+  // Upper triangular U with A= U^T U and zero lower triangle, false if
+  // A is not positive definite:
+  virtual bool cholesky( const TMatrixDSym& matrix,
+			 TMatrixD& upper ) const=0;
+  // Replace the columns of B by A^-1 B with U from cholesky:
+  virtual void choleskySolve( const TMatrixD& upper,
+			      TMatrixD& bmatrix ) const=0;
+  // W A W^T for symmetric A:
+  virtual TMatrixDSym similarity( const TMatrixD& weightsmatrix,
+				  const TMatrixDSym& matrix ) const=0;
+  // C= A B, C has the right size:
+  virtual void multiply( const TMatrixD& amatrix, const TMatrixD& bmatrix,
+			 TMatrixD& result ) const=0;
+};
+
+// Backend in use, set before combinations are made. Names are "root"
+// and, if compiled in, "lapack", unknown names throw:
+LinearAlgebra& getLinearAlgebra();
+void setLinearAlgebra( const std::string& name );
+void setLinearAlgebra( LinearAlgebra& backend );
+
+#endif
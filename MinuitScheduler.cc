@@ -0,0 +1,211 @@
+#include "MinuitScheduler.hh"
+#include "Parallel.hh"
+
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <exception>
+
+using std::string;
+using std::vector;
+
+// Fit jobs:
+MinuitFitJob::MinuitFitJob( fcn_t fcn,
+			    const vector<string>& parnames,
+			    const TVectorD& pars,
+			    const TVectorD& parerrors,
+			    int ndof, int maxpars, MinuitEngineType engine ) :
+  m_fcn( fcn ), m_msf( 0 ), m_parnames( parnames ), m_pars( pars ),
+  m_parerrors( parerrors ), m_ndof( ndof ), m_maxpars( maxpars ),
+  m_engine( engine ) {}
+
+MinuitFitJob::MinuitFitJob( MinuitSolverFunction& msf,
+			    const vector<string>& parnames,
+			    const TVectorD& pars,
+			    const TVectorD& parerrors,
+			    int ndof, int maxpars, MinuitEngineType engine ) :
+  m_fcn( 0 ), m_msf( &msf ), m_parnames( parnames ), m_pars( pars ),
+  m_parerrors( parerrors ), m_ndof( ndof ), m_maxpars( maxpars ),
+  m_engine( engine ) {}
+
+minuitfit_t MinuitFitJob::run() const {
+  minuitfit_t result;
+  result.chisq= 0.0;
+  result.status= -1;
+  try {
+    MinuitSolver* solver;
+    if( m_msf ) {
+      solver= new MinuitSolver( *m_msf, m_parnames, m_pars, m_parerrors,
+				m_ndof, true, m_maxpars, m_engine );
+    }
+    else {
+      solver= new MinuitSolver( m_fcn, m_parnames, m_pars, m_parerrors,
+				m_ndof, true, m_maxpars, m_engine );
+    }
+    std::unique_ptr<MinuitSolver> owner( solver );
+    solver->solve();
+    const MinuitResult& snapshot= solver->getResult();
+    result.pars.ResizeTo( m_pars );
+    result.pars= snapshot.getPars();
+    result.parerrors.ResizeTo( m_pars );
+    result.parerrors= snapshot.getParErrors();
+    result.covariance.ResizeTo( snapshot.getCovarianceMatrix() );
+    result.covariance= snapshot.getCovarianceMatrix();
+    result.chisq= snapshot.getChisq();
+    result.status= snapshot.getStatus();
+  }
+  catch( const std::exception& e ) {
+    result.status= -1;
+    result.error= e.what();
+  }
+  catch( ... ) {
+    result.status= -1;
+    result.error= "unknown exception";
+  }
+  return result;
+}
+
+// Pool with one deque per worker. Workers take from the front of their
+// own deque and steal from the back of the others. The deques are only
+// touched under the pool mutex, the fits run outside of it. unfinished
+// counts tasks not yet done for wait():
+class MinuitSchedulerPool {
+public:
+  typedef std::function<void()> Task;
+  MinuitSchedulerPool( unsigned nthreads ) :
+    m_queues( nthreads ), m_queued( 0 ), m_unfinished( 0 ), m_next( 0 ),
+    m_stop( false ) {
+    for( unsigned ithread= 0; ithread < nthreads; ithread++ ) {
+      m_threads.push_back( std::thread( &MinuitSchedulerPool::work, this,
+					ithread ) );
+    }
+  }
+  ~MinuitSchedulerPool() {
+    wait();
+    {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      m_stop= true;
+    }
+    m_wakeup.notify_all();
+    for( size_t ithread= 0; ithread < m_threads.size(); ithread++ ) {
+      m_threads[ithread].join();
+    }
+  }
+  unsigned getNthreads() const { return m_queues.size(); }
+  void push( const Task& task ) {
+    {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      m_unfinished++;
+      m_queued++;
+      m_queues[m_next++ % m_queues.size()].push_back( task );
+    }
+    m_wakeup.notify_one();
+    return;
+  }
+  void wait() {
+    std::unique_lock<std::mutex> lock( m_mutex );
+    while( m_unfinished > 0 ) m_done.wait( lock );
+    return;
+  }
+private:
+  bool pop( unsigned ithread, Task& task ) {
+    size_t nqueues= m_queues.size();
+    for( size_t iqueue= 0; iqueue < nqueues; iqueue++ ) {
+      std::deque<Task>& queue= m_queues[(ithread+iqueue) % nqueues];
+      if( queue.empty() ) continue;
+      if( iqueue == 0 ) {
+	task= queue.front();
+	queue.pop_front();
+      }
+      else {
+	task= queue.back();
+	queue.pop_back();
+      }
+      return true;
+    }
+    return false;
+  }
+  void work( unsigned ithread ) {
+    while( true ) {
+      Task task;
+      {
+	std::unique_lock<std::mutex> lock( m_mutex );
+	while( m_queued == 0 and not m_stop ) m_wakeup.wait( lock );
+	if( m_queued == 0 ) return;
+	if( not pop( ithread, task ) ) continue;
+	m_queued--;
+      }
+      task();
+      std::lock_guard<std::mutex> lock( m_mutex );
+      if( --m_unfinished == 0 ) m_done.notify_all();
+    }
+  }
+  vector<std::deque<Task> > m_queues;
+  vector<std::thread> m_threads;
+  std::mutex m_mutex;
+  std::condition_variable m_wakeup;
+  std::condition_variable m_done;
+  size_t m_queued;
+  size_t m_unfinished;
+  size_t m_next;
+  bool m_stop;
+};
+
+// Scheduler:
+MinuitScheduler::MinuitScheduler( unsigned nthreads ) :
+  m_pool( new MinuitSchedulerPool( nthreads > 0 ? nthreads :
+				   defaultThreads() ) ) {}
+
+MinuitScheduler::~MinuitScheduler() {
+  delete m_pool;
+}
+
+unsigned MinuitScheduler::getNthreads() const {
+  return m_pool->getNthreads();
+}
+
+std::future<minuitfit_t> MinuitScheduler::submit( const MinuitFitJob& job ) {
+  std::shared_ptr<std::promise<minuitfit_t> >
+    promise( new std::promise<minuitfit_t> );
+  std::future<minuitfit_t> future= promise->get_future();
+  m_pool->push( [job,promise]() { promise->set_value( job.run() ); } );
+  return future;
+}
+
+// Exceptions from callbacks would end the worker thread, they are 
+// passed on to the future instead:
+std::future<void> MinuitScheduler::submit( const MinuitFitJob& job,
+					   const Callback& callback ) {
+  std::shared_ptr<std::promise<void> > promise( new std::promise<void> );
+  std::future<void> future= promise->get_future();
+  m_pool->push( [job,callback,promise]() {
+      try {
+	callback( job.run() );
+	promise->set_value();
+      }
+      catch( ... ) {
+	promise->set_exception( std::current_exception() );
+      }
+    } );
+  return future;
+}
+
+vector<minuitfit_t>
+MinuitScheduler::run( const vector<MinuitFitJob>& jobs ) {
+  vector<std::future<minuitfit_t> > futures;
+  for( size_t ijob= 0; ijob < jobs.size(); ijob++ ) {
+    futures.push_back( submit( jobs[ijob] ) );
+  }
+  vector<minuitfit_t> results;
+  for( size_t ijob= 0; ijob < futures.size(); ijob++ ) {
+    results.push_back( futures[ijob].get() );
+  }
+  return results;
+}
+
+void MinuitScheduler::wait() {
+  m_pool->wait();
+  return;
+}
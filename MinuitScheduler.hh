@@ -0,0 +1,81 @@
+#ifndef MINUITSCHEDULER_HH
+#define MINUITSCHEDULER_HH
+
+#include "MinuitSolver.hh"
+
+#include <string>
+#include <vector>
+#include <future>
+#include <functional>
+
+// Result of a scheduled fit, error is empty unless the fit threw, then
+// status is -1:
+struct minuitfit_t {
+  TVectorD pars;
+  TVectorD parerrors;
+  TMatrixDSym covariance;
+  Double_t chisq;
+  Int_t status;
+  std::string error;
+};
+
+// A fit with the arguments of the MinuitSolver constructors. Function
+// objects are held by reference and must live until the fit is done,
+// jobs running at the same time need their own function objects. With
+// kTMinuit every fit holds the process wide TMinuit lock, jobs then run
+// one at a time whatever the number of threads, only kMinuit2 jobs run
+// in parallel:
+class MinuitFitJob {
+public:
+  MinuitFitJob( fcn_t fcn,
+		const std::vector<std::string>& parnames,
+		const TVectorD& pars,
+		const TVectorD& parerrors,
+		int ndf, int maxpars=50, MinuitEngineType engine=kTMinuit );
+  MinuitFitJob( MinuitSolverFunction& msf,
+		const std::vector<std::string>& parnames,
+		const TVectorD& pars,
+		const TVectorD& parerrors,
+		int ndf, int maxpars=50, MinuitEngineType engine=kTMinuit );
+  // MIGRAD and the results, does not throw, any exception gives status
+  // -1 and its message in error:
+  minuitfit_t run() const;
+private:
+  fcn_t m_fcn;
+  MinuitSolverFunction* m_msf;
+  std::vector<std::string> m_parnames;
+  TVectorD m_pars;
+  TVectorD m_parerrors;
+  int m_ndof;
+  int m_maxpars;
+  MinuitEngineType m_engine;
+};
+
+class MinuitSchedulerPool;
+
+// Thread pool for fit jobs. Each worker has its own queue and steals
+// from the others when it runs empty, so long fits do not leave threads
+// idle next to a queue of short ones. Callbacks run in the worker
+// thread which did the fit, an exception from a callback is rethrown by
+// get of the returned future. The destructor finishes all submitted 
+// jobs. TMinuit fits are serialised, see MinuitFitJob:
+class MinuitScheduler {
+public:
+  typedef std::function<void( const minuitfit_t& )> Callback;
+  MinuitScheduler( unsigned nthreads=0 );
+  ~MinuitScheduler();
+  unsigned getNthreads() const;
+  std::future<minuitfit_t> submit( const MinuitFitJob& job );
+  std::future<void> submit( const MinuitFitJob& job, 
+			    const Callback& callback );
+  // Results in the order of jobs:
+  std::vector<minuitfit_t> run( const std::vector<MinuitFitJob>& jobs );
+  // Block until all submitted jobs are done:
+  void wait();
+private:
+  MinuitScheduler( const MinuitScheduler& );
+  MinuitScheduler& operator=( const MinuitScheduler& );
+  MinuitSchedulerPool* m_pool;
+};
+
+#endif
@@ -1,10 +1,26 @@
 
 #include "MinuitSolver.hh"
+#include "LinearAlgebra.hh"
 #include <vector>
 #include <cmath>
 #include <sstream>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
 #include "TMath.h"
 
+#ifdef AVERAGETOOLS_MINUIT2
+#include "Minuit2/FCNGradientBase.h"
+#include "Minuit2/MnUserParameters.h"
+#include "Minuit2/MnUserParameterState.h"
+#include "Minuit2/MnUserCovariance.h"
+#include "Minuit2/MnMigrad.h"
+#include "Minuit2/MnHesse.h"
+#include "Minuit2/FunctionMinimum.h"
+#endif
+
 using std::string;
 using std::stringstream;
 using std::vector;
@@ -23,35 +39,592 @@ private:
   MinuitSolverFunction& m_msf;
 };
 
-// Errors from Minuit:
+// Gradient functions for Minuit, the gradient only when asked for:
+bool MinuitSolverGradientFunction::hessian( Int_t, const Double_t*, 
+					    Double_t* ) {
+  return false;
+}
+void MinuitSolverGradientFunction::operator()( Int_t& npar, Double_t* grad,
+					       Double_t& fval, 
+					       Double_t* pars, Int_t iflag ) {
+  fval= value( npar, pars );
+  if( iflag == 2 ) gradient( npar, pars, grad );
+  return;
+}
+
+// Linear models, data and weights need one element per row of A:
+LinearModel::LinearModel( const TMatrixD& design, const TVectorD& data,
+			  const TVectorD& weights ) :
+  m_design( design ), m_data( data ), m_weights( weights ), 
+  m_diagonal( true ) {
+  checkSizes( weights.GetNoElements() );
+}
+
+LinearModel::LinearModel( const TMatrixD& design, const TVectorD& data,
+			  const TMatrixDSym& weightmatrix ) :
+  m_design( design ), m_data( data ), m_weightmatrix( weightmatrix ),
+  m_diagonal( false ) {
+  checkSizes( weightmatrix.GetNrows() );
+}
+
+void LinearModel::checkSizes( Int_t nweights ) const {
+  Int_t nres= m_design.GetNrows();
+  if( m_data.GetNoElements() != nres or nweights != nres ) {
+    throw std::invalid_argument( "LinearModel: design matrix, data and "
+				 "weights differ in size" );
+  }
+  return;
+}
+void LinearModel::checkNpar( Int_t npar ) const {
+  if( npar != m_design.GetNcols() ) {
+    throw std::invalid_argument( "LinearModel: wrong number of "
+				 "parameters" );
+  }
+  return;
+}
+
+void LinearModel::residuals( const Double_t* pars, TVectorD& residuals,
+			     TVectorD& weighted ) const {
+  Int_t nres= m_design.GetNrows();
+  Int_t npar= m_design.GetNcols();
+  const Double_t* design= m_design.GetMatrixArray();
+  residuals.ResizeTo( nres );
+  for( Int_t ires= 0; ires < nres; ires++ ) {
+    const Double_t* row= design + ires*npar;
+    Double_t sum= m_data[ires];
+    for( Int_t ipar= 0; ipar < npar; ipar++ ) sum-= row[ipar]*pars[ipar];
+    residuals[ires]= sum;
+  }
+  weighted.ResizeTo( nres );
+  if( m_diagonal ) {
+    for( Int_t ires= 0; ires < nres; ires++ ) {
+      weighted[ires]= m_weights[ires]*residuals[ires];
+    }
+  }
+  else {
+    weighted= residuals;
+    weighted*= m_weightmatrix;
+  }
+  return;
+}
+
+Double_t LinearModel::value( Int_t npar, const Double_t* pars ) {
+  checkNpar( npar );
+  TVectorD res;
+  TVectorD weighted;
+  residuals( pars, res, weighted );
+  Double_t chisq= 0.0;
+  for( Int_t ires= 0; ires < res.GetNoElements(); ires++ ) {
+    chisq+= res[ires]*weighted[ires];
+  }
+  return chisq;
+}
+
+// -2 A^T W r:
+void LinearModel::gradient( Int_t npar, const Double_t* pars, 
+			    Double_t* grad ) {
+  checkNpar( npar );
+  TVectorD res;
+  TVectorD weighted;
+  residuals( pars, res, weighted );
+  const Double_t* design= m_design.GetMatrixArray();
+  for( Int_t ipar= 0; ipar < npar; ipar++ ) grad[ipar]= 0.0;
+  for( Int_t ires= 0; ires < res.GetNoElements(); ires++ ) {
+    const Double_t* row= design + ires*npar;
+    for( Int_t ipar= 0; ipar < npar; ipar++ ) {
+      grad[ipar]-= 2.0*row[ipar]*weighted[ires];
+    }
+  }
+  return;
+}
+
+// 2 A^T W A, independent of the parameters:
+bool LinearModel::hessian( Int_t npar, const Double_t*, Double_t* hess ) {
+  if( npar != m_design.GetNcols() ) return false;
+  TMatrixDSym normal= normalMatrix();
+  const Double_t* elements= normal.GetMatrixArray();
+  for( Int_t i= 0; i < npar*npar; i++ ) hess[i]= 2.0*elements[i];
+  return true;
+}
+
+TMatrixDSym LinearModel::normalMatrix() const {
+  Int_t nres= m_design.GetNrows();
+  Int_t npar= m_design.GetNcols();
+  if( not m_diagonal ) {
+    TMatrixD designt( TMatrixD::kTransposed, m_design );
+    return getLinearAlgebra().similarity( designt, m_weightmatrix );
+  }
+  TMatrixDSym normal( npar );
+  const Double_t* design= m_design.GetMatrixArray();
+  for( Int_t ires= 0; ires < nres; ires++ ) {
+    const Double_t* row= design + ires*npar;
+    Double_t weight= m_weights[ires];
+    for( Int_t ipar= 0; ipar < npar; ipar++ ) {
+      Double_t wa= weight*row[ipar];
+      for( Int_t jpar= 0; jpar <= ipar; jpar++ ) {
+	normal(ipar,jpar)+= wa*row[jpar];
+      }
+    }
+  }
+  for( Int_t ipar= 0; ipar < npar; ipar++ ) {
+    for( Int_t jpar= 0; jpar < ipar; jpar++ ) {
+      normal(jpar,ipar)= normal(ipar,jpar);
+    }
+  }
+  return normal;
+}
+
+// Cholesky factor of A^T W A and substitution for A^T W y, the
+// residuals at p= 0 are y and W y:
+bool LinearModel::solve( TVectorD& pars, Double_t& chisq ) const {
+  Int_t npar= m_design.GetNcols();
+  TMatrixD upper;
+  if( not getLinearAlgebra().cholesky( normalMatrix(), upper ) ) return false;
+  vector<Double_t> zero( npar );
+  TVectorD data;
+  TVectorD weighted;
+  residuals( &zero[0], data, weighted );
+  TMatrixD rhs( npar, 1 );
+  const Double_t* design= m_design.GetMatrixArray();
+  for( Int_t ires= 0; ires < weighted.GetNoElements(); ires++ ) {
+    const Double_t* row= design + ires*npar;
+    for( Int_t ipar= 0; ipar < npar; ipar++ ) {
+      rhs(ipar,0)+= row[ipar]*weighted[ires];
+    }
+  }
+  getLinearAlgebra().choleskySolve( upper, rhs );
+  pars.ResizeTo( npar );
+  for( Int_t ipar= 0; ipar < npar; ipar++ ) pars[ipar]= rhs(ipar,0);
+  TVectorD res;
+  residuals( pars.GetMatrixArray(), res, weighted );
+  chisq= 0.0;
+  for( Int_t ires= 0; ires < res.GetNoElements(); ires++ ) {
+    chisq+= res[ires]*weighted[ires];
+  }
+  return true;
+}
+
+// Errors from Minuit, the message is kept for what():
 class MinuitError: public std::exception {
 public:
-  MinuitError( int ierr, const char* txt ) : 
-    errorcode( ierr ), message( txt ) {}
-  virtual const char* what() const throw() {
+  MinuitError( int ierr, const string& txt ) {
     stringstream strstr;
-    strstr << "Minuit error: " << errorcode << " "
-	   << message;
-    string txt= strstr.str();
-    return txt.c_str();
+    strstr << "Minuit error: " << ierr << " " << txt;
+    message= strstr.str();
+  }
+  virtual ~MinuitError() throw() {}
+  virtual const char* what() const throw() {
+    return message.c_str();
+  }
+private:
+  string message;
+};
+
+// Minimiser interface used by MinuitSolver, one instance per solver:
+class MinuitEngine {
+public:
+  virtual ~MinuitEngine() {}
+  virtual Int_t defineParameter( Int_t ipar, const string& name, 
+				 Double_t value, Double_t error )=0;
+  virtual Int_t getParameter( Int_t ipar, Double_t& value, 
+			      Double_t& error )=0;
+  virtual stat_t getStat()=0;
+  virtual bool isFixed( Int_t ipar )=0;
+  // npar x npar with zero rows and columns for fixed parameters:
+  virtual void getCovariance( Double_t* matrix, Int_t npar )=0;
+  virtual Int_t command( const string& cmd )=0;
+  virtual void eval( Int_t npar, Double_t* grad, Double_t& fval, 
+		     Double_t* pars, Int_t iflag )=0;
+};
+
+// TMinuit shares gMinuit and static state between instances. Every call
+// holds the lock and makes its own instance current, recursive for fcns 
+// which run fits themselves:
+static std::recursive_mutex& tminuitMutex() {
+  static std::recursive_mutex mutex;
+  return mutex;
+}
+class TMinuitLock {
+public:
+  TMinuitLock( TMinuit* minuit ) : m_lock( tminuitMutex() ) {
+    if( minuit ) gMinuit= minuit;
+  }
+private:
+  std::lock_guard<std::recursive_mutex> m_lock;
+};
+
+class TMinuitEngine: public MinuitEngine {
+public:
+  TMinuitEngine( fcn_t fcn, Int_t maxpars ) {
+    TMinuitLock lock( 0 );
+    m_minuit= new TMinuit( maxpars );
+    m_minuit->SetFCN( fcn );
+  }
+  TMinuitEngine( MinuitSolverFunction& msf, Int_t maxpars ) {
+    TMinuitLock lock( 0 );
+    m_minuit= new myTMinuit( msf, maxpars );
+  }
+  virtual ~TMinuitEngine() {
+    TMinuitLock lock( m_minuit );
+    delete m_minuit;
+  }
+  virtual Int_t defineParameter( Int_t ipar, const string& name, 
+				 Double_t value, Double_t error ) {
+    TMinuitLock lock( m_minuit );
+    return m_minuit->DefineParameter( ipar, name.c_str(), value, error, 
+				      0.0, 0.0 );
+  }
+  virtual Int_t getParameter( Int_t ipar, Double_t& value, 
+			      Double_t& error ) {
+    TMinuitLock lock( m_minuit );
+    return m_minuit->GetParameter( ipar, value, error );
+  }
+  virtual stat_t getStat() {
+    TMinuitLock lock( m_minuit );
+    stat_t hstat;
+    m_minuit->mnstat( hstat.min, hstat.edm, hstat.errdef, 
+		      hstat.npari, hstat.nparx, hstat.status );
+    return hstat;
+  }
+  // GetParameter gives the internal number, 0 for fixed parameters:
+  virtual bool isFixed( Int_t ipar ) {
+    TMinuitLock lock( m_minuit );
+    Double_t value;
+    Double_t error;
+    return m_minuit->GetParameter( ipar, value, error ) == 0;
+  }
+  // mnemat fills only the free parameters:
+  virtual void getCovariance( Double_t* matrix, Int_t npar ) {
+    TMinuitLock lock( m_minuit );
+    vector<Int_t> free;
+    for( Int_t ipar= 0; ipar < npar; ipar++ ) {
+      if( not isFixed( ipar ) ) free.push_back( ipar );
+    }
+    Int_t nfree= free.size();
+    vector<Double_t> freematrix( nfree*nfree+1 );
+    if( nfree > 0 ) m_minuit->mnemat( &freematrix[0], nfree );
+    for( Int_t i= 0; i < npar*npar; i++ ) matrix[i]= 0.0;
+    for( Int_t ifree= 0; ifree < nfree; ifree++ ) {
+      for( Int_t jfree= 0; jfree < nfree; jfree++ ) {
+	matrix[free[ifree]*npar+free[jfree]]= 
+	  freematrix[ifree*nfree+jfree];
+      }
+    }
+    return;
+  }
+  virtual Int_t command( const string& cmd ) {
+    TMinuitLock lock( m_minuit );
+    return m_minuit->Command( cmd.c_str() );
+  }
+  virtual void eval( Int_t npar, Double_t* grad, Double_t& fval, 
+		     Double_t* pars, Int_t iflag ) {
+    TMinuitLock lock( m_minuit );
+    m_minuit->Eval( npar, grad, fval, pars, iflag );
+    return;
+  }
+private:
+  TMinuit* m_minuit;
+};
+
+#ifdef AVERAGETOOLS_MINUIT2
+
+// Minuit2 keeps no global state, the engine understands the commands
+// MinuitSolver uses: MIGRAD and MINIMIZE [maxcalls [tolerance]], HESSE 
+// and SET GRAD, NOGRAD, ERRDEF, PRINTOUT. Other commands fail with 3 
+// like unknown commands in TMinuit:
+class Minuit2Engine: public MinuitEngine {
+public:
+  Minuit2Engine( fcn_t fcn, MinuitSolverFunction* msf ) :
+    m_fcn( fcn ), m_msf( msf ), m_usegradient( false ), m_errdef( 1.0 ),
+    m_status( 0 ) {}
+  virtual Int_t defineParameter( Int_t ipar, const string& name, 
+				 Double_t value, Double_t error ) {
+    Int_t npar= m_params.Params().size();
+    if( ipar < npar ) {
+      m_params.SetValue( ipar, value );
+      m_params.SetError( ipar, error );
+    }
+    else if( ipar == npar ) {
+      m_params.Add( name, value, error );
+    }
+    else {
+      return 1;
+    }
+    m_state= ROOT::Minuit2::MnUserParameterState( m_params );
+    return 0;
+  }
+  virtual Int_t getParameter( Int_t ipar, Double_t& value, 
+			      Double_t& error ) {
+    if( ipar < 0 or ipar >= Int_t( m_params.Params().size() ) ) return -1;
+    value= m_state.Value( ipar );
+    error= m_state.Error( ipar );
+    return ipar;
   }
+  virtual stat_t getStat() {
+    stat_t hstat;
+    hstat.min= m_state.Fval();
+    hstat.edm= m_state.Edm();
+    hstat.errdef= m_errdef;
+    hstat.npari= m_params.Params().size();
+    hstat.nparx= hstat.npari;
+    hstat.status= m_status;
+    return hstat;
+  }
+  // No FIX command:
+  virtual bool isFixed( Int_t ) { return false; }
+  virtual void getCovariance( Double_t* matrix, Int_t npar ) {
+    for( Int_t ipar= 0; ipar < npar; ipar++ ) {
+      for( Int_t jpar= 0; jpar < npar; jpar++ ) {
+	matrix[ipar*npar+jpar]= m_state.HasCovariance() ? 
+	  m_state.Covariance()( ipar, jpar ) : 0.0;
+      }
+    }
+    return;
+  }
+  virtual Int_t command( const string& cmd );
+  virtual void eval( Int_t npar, Double_t* grad, Double_t& fval, 
+		     Double_t* pars, Int_t iflag ) {
+    if( m_msf ) (*m_msf)( npar, grad, fval, pars, iflag );
+    else m_fcn( npar, grad, fval, pars, iflag );
+    return;
+  }
+  Double_t value( const vector<Double_t>& pars ) {
+    vector<Double_t> point( pars );
+    vector<Double_t> grad( pars.size() );
+    Double_t fval= 0.0;
+    eval( point.size(), &grad[0], fval, &point[0], 4 );
+    return fval;
+  }
+  vector<Double_t> gradient( const vector<Double_t>& pars ) {
+    vector<Double_t> point( pars );
+    vector<Double_t> grad( pars.size() );
+    Double_t fval= 0.0;
+    eval( point.size(), &grad[0], fval, &point[0], 2 );
+    return grad;
+  }
+  Double_t getErrdef() const { return m_errdef; }
+private:
+  Int_t migrad( unsigned int maxcalls, Double_t tolerance );
+  Int_t hesse( unsigned int maxcalls );
+  fcn_t m_fcn;
+  MinuitSolverFunction* m_msf;
+  bool m_usegradient;
+  Double_t m_errdef;
+  Int_t m_status;
+  ROOT::Minuit2::MnUserParameters m_params;
+  ROOT::Minuit2::MnUserParameterState m_state;
+};
+
+// Adaptors of the engine to the Minuit2 function interfaces:
+class Minuit2Function: public ROOT::Minuit2::FCNBase {
+public:
+  Minuit2Function( Minuit2Engine& engine ) : m_engine( engine ) {}
+  virtual double operator()( const vector<double>& pars ) const {
+    return m_engine.value( pars );
+  }
+  virtual double Up() const { return m_engine.getErrdef(); }
 private:
-  int errorcode;
-  const char* message;
+  Minuit2Engine& m_engine;
 };
+class Minuit2GradientFunction: public ROOT::Minuit2::FCNGradientBase {
+public:
+  Minuit2GradientFunction( Minuit2Engine& engine ) : m_engine( engine ) {}
+  virtual double operator()( const vector<double>& pars ) const {
+    return m_engine.value( pars );
+  }
+  virtual vector<double> Gradient( const vector<double>& pars ) const {
+    return m_engine.gradient( pars );
+  }
+  virtual bool CheckGradient() const { return false; }
+  virtual double Up() const { return m_engine.getErrdef(); }
+private:
+  Minuit2Engine& m_engine;
+};
+
+// Status like TMinuit: 3 accurate covariance, 2 forced positive 
+// definite, 1 approximate, 0 none. Error 4 for an invalid minimum:
+Int_t Minuit2Engine::migrad( unsigned int maxcalls, Double_t tolerance ) {
+  Minuit2Function function( *this );
+  Minuit2GradientFunction gradfunction( *this );
+  ROOT::Minuit2::FunctionMinimum minimum= m_usegradient ?
+    ROOT::Minuit2::MnMigrad( gradfunction, m_state )( maxcalls, tolerance ) :
+    ROOT::Minuit2::MnMigrad( function, m_state )( maxcalls, tolerance );
+  m_state= minimum.UserState();
+  if( minimum.HasAccurateCovar() ) m_status= 3;
+  else if( minimum.HasMadePosDefCovar() ) m_status= 2;
+  else if( minimum.HasCovariance() ) m_status= 1;
+  else m_status= 0;
+  return minimum.IsValid() ? 0 : 4;
+}
+Int_t Minuit2Engine::hesse( unsigned int maxcalls ) {
+  Minuit2Function function( *this );
+  m_state= ROOT::Minuit2::MnHesse()( function, m_state, maxcalls );
+  m_status= m_state.HasCovariance() ? 3 : 0;
+  return m_state.IsValid() ? 0 : 4;
+}
+
+static string upperCase( string word ) {
+  for( size_t ichar= 0; ichar < word.size(); ichar++ ) {
+    word[ichar]= std::toupper( word[ichar] );
+  }
+  return word;
+}
+Int_t Minuit2Engine::command( const string& cmd ) {
+  std::istringstream ist( cmd );
+  string word;
+  ist >> word;
+  word= upperCase( word );
+  if( word.compare( 0, 3, "MIG" ) == 0 or word.compare( 0, 3, "MIN" ) == 0 ) {
+    Double_t maxcalls= 0.0;
+    Double_t tolerance= 0.1;
+    Double_t number= 0.0;
+    if( ist >> number ) {
+      maxcalls= number;
+      if( ist >> number ) tolerance= number;
+    }
+    return migrad( maxcalls, tolerance );
+  }
+  if( word.compare( 0, 3, "HES" ) == 0 ) {
+    Double_t maxcalls= 0.0;
+    ist >> maxcalls;
+    return hesse( maxcalls );
+  }
+  if( word == "SET" ) {
+    string option;
+    ist >> option;
+    option= upperCase( option );
+    if( option.compare( 0, 3, "GRA" ) == 0 ) m_usegradient= true;
+    else if( option.compare( 0, 3, "NOG" ) == 0 ) m_usegradient= false;
+    else if( option.compare( 0, 3, "ERR" ) == 0 ) ist >> m_errdef;
+    else if( option.compare( 0, 3, "PRI" ) != 0 ) return 3;
+    return 0;
+  }
+  return 3;
+}
+
+#endif
+
+// Result snapshots:
+MinuitResult::MinuitResult() : m_ndof( 0 ) {
+  m_stat.min= 0.0;
+  m_stat.edm= 0.0;
+  m_stat.errdef= 0.0;
+  m_stat.npari= 0;
+  m_stat.nparx= 0;
+  m_stat.status= 0;
+}
+
+MinuitResult::MinuitResult( const vector<string>& parnames, 
+			    const TVectorD& pars, const TVectorD& parerrors,
+			    const TMatrixDSym& covariance, const stat_t& stat,
+			    int ndof ) :
+  m_parnames( parnames ), m_pars( pars ), m_parerrors( parerrors ),
+  m_covariance( covariance ), m_correlation( covariance.GetNrows() ),
+  m_stat( stat ), m_ndof( ndof ) {
+  Int_t nPars= covariance.GetNrows();
+  for( Int_t i= 0; i < nPars; ++i ) {
+    for( Int_t j= 0; j < nPars; ++j ) {
+      Double_t norm= sqrt( covariance(i,i)*covariance(j,j) );
+      m_correlation(i,j)= norm > 0.0 ? covariance(i,j)/norm : 0.0;
+    }
+  }
+}
+
+MinuitResult& MinuitResult::operator=( const MinuitResult& other ) {
+  if( this == &other ) return *this;
+  m_parnames= other.m_parnames;
+  m_pars.ResizeTo( other.m_pars );
+  m_pars= other.m_pars;
+  m_parerrors.ResizeTo( other.m_parerrors );
+  m_parerrors= other.m_parerrors;
+  m_covariance.ResizeTo( other.m_covariance );
+  m_covariance= other.m_covariance;
+  m_correlation.ResizeTo( other.m_correlation );
+  m_correlation= other.m_correlation;
+  m_stat= other.m_stat;
+  m_ndof= other.m_ndof;
+  return *this;
+}
+
+// Header line with sizes, fit quality, one line per parameter and the
+// covariance matrix row by row:
+void MinuitResult::write( std::ostream& ost ) const {
+  Int_t nPars= m_pars.GetNoElements();
+  std::streamsize precision= ost.precision( 17 );
+  ost << "MinuitResult " << nPars << " " << m_ndof << " " << m_stat.status 
+      << " " << m_stat.npari << " " << m_stat.nparx << "\n"
+      << m_stat.min << " " << m_stat.edm << " " << m_stat.errdef << "\n";
+  for( Int_t iPar= 0; iPar < nPars; ++iPar ) {
+    ost << m_parnames[iPar] << " " << m_pars[iPar] << " " 
+	<< m_parerrors[iPar] << "\n";
+  }
+  for( Int_t iPar= 0; iPar < nPars; ++iPar ) {
+    for( Int_t jPar= 0; jPar < nPars; ++jPar ) {
+      ost << m_covariance(iPar,jPar) << ( jPar+1 < nPars ? " " : "\n" );
+    }
+  }
+  ost.precision( precision );
+  return;
+}
+
+MinuitResult MinuitResult::read( std::istream& ist ) {
+  string tag;
+  Int_t nPars= -1;
+  int ndof= 0;
+  stat_t hstat;
+  ist >> tag >> nPars >> ndof >> hstat.status >> hstat.npari >> hstat.nparx
+      >> hstat.min >> hstat.edm >> hstat.errdef;
+  if( not ist or tag != "MinuitResult" or nPars < 0 ) {
+    throw MinuitError( 0, "in MinuitResult::read header" );
+  }
+  vector<string> parnames( nPars );
+  TVectorD pars( nPars );
+  TVectorD parerrors( nPars );
+  for( Int_t iPar= 0; iPar < nPars; ++iPar ) {
+    ist >> parnames[iPar] >> pars[iPar] >> parerrors[iPar];
+  }
+  TMatrixDSym covariance( nPars );
+  for( Int_t iPar= 0; iPar < nPars; ++iPar ) {
+    for( Int_t jPar= 0; jPar < nPars; ++jPar ) {
+      ist >> covariance(iPar,jPar);
+    }
+  }
+  if( not ist ) throw MinuitError( 0, "in MinuitResult::read parameters" );
+  return MinuitResult( parnames, pars, parerrors, covariance, hstat, ndof );
+}
+
+// Engine factory, Minuit2 must be compiled in:
+static MinuitEngine* createEngine( MinuitEngineType type, fcn_t fcn,
+				   MinuitSolverFunction* msf, 
+				   Int_t maxpars ) {
+  if( type == kMinuit2 ) {
+#ifdef AVERAGETOOLS_MINUIT2
+    return new Minuit2Engine( fcn, msf );
+#else
+    throw MinuitError( 0, "Minuit2 engine not compiled in" );
+#endif
+  }
+  if( msf ) return new TMinuitEngine( *msf, maxpars );
+  return new TMinuitEngine( fcn, maxpars );
+}
 
 // Configuration for use with standard Minuit fcn:
 MinuitSolver::MinuitSolver( fcn_t fcn, 
 			    const vector<string>& parnames, 
 			    const TVectorD& pars, 
 			    const TVectorD& parerrors, 
-			    int ndof, bool quiet, int maxpars ) :
+			    int ndof, bool quiet, int maxpars,
+			    MinuitEngineType engine ) :
   m_parnames( parnames ),
   m_pars( pars ),
   m_parerrors( parerrors ),
   m_ndof( ndof ),
-  m_minuit( new TMinuit( maxpars ) ) {
-  m_minuit->SetFCN( fcn );
+  m_engine( createEngine( engine, fcn, 0, maxpars ) ),
+  m_gradfunction( 0 ),
+  m_linearmodel( 0 ),
+  m_linearsolved( false ),
+  m_linearchisq( 0.0 ),
+  m_resultvalid( false ) {
   initialise( maxpars, quiet );
   return;
 }
@@ -61,13 +634,20 @@ MinuitSolver::MinuitSolver( MinuitSolverFunction& msf,
 			    const vector<string>& parnames, 
 			    const TVectorD& pars, 
 			    const TVectorD& parerrors, 
-			    int ndof, bool quiet, int maxpars ) :
+			    int ndof, bool quiet, int maxpars,
+			    MinuitEngineType engine ) :
   m_parnames( parnames ),
   m_pars( pars ),
   m_parerrors( parerrors ),
   m_ndof( ndof ),
-  m_minuit( new myTMinuit( msf, maxpars ) ) {
+  m_engine( createEngine( engine, 0, &msf, maxpars ) ),
+  m_gradfunction( dynamic_cast<MinuitSolverGradientFunction*>( &msf ) ),
+  m_linearmodel( dynamic_cast<LinearModel*>( &msf ) ),
+  m_linearsolved( false ),
+  m_linearchisq( 0.0 ),
+  m_resultvalid( false ) {
   initialise( maxpars, quiet );
+  if( m_gradfunction ) useGradient();
   return;
 }
 
@@ -75,7 +655,7 @@ MinuitSolver::MinuitSolver( MinuitSolverFunction& msf,
 void MinuitSolver::initialise( Int_t maxpars, bool quiet ) {
   checkMaxpars( maxpars );
   if( quiet ) minuitCommand( "SET PRI -1" );
-  setupParameters();
+  setupParameters( m_pars );
   return;
 }
 
@@ -88,12 +668,11 @@ void MinuitSolver::checkMaxpars( Int_t maxpars ) {
   }
   return;
 }
-void MinuitSolver::setupParameters() {
-  Int_t nPars= m_pars.GetNoElements();
+void MinuitSolver::setupParameters( const TVectorD& pars ) const {
+  Int_t nPars= pars.GetNoElements();
   for( int iPar= 0; iPar < nPars; ++iPar ) {
-    int error= m_minuit->DefineParameter( iPar, m_parnames[iPar].c_str(), 
-					  m_pars(iPar), m_parerrors(iPar), 
-					  0.0, 0.0);
+    int error= m_engine->defineParameter( iPar, m_parnames[iPar], 
+					  pars(iPar), m_parerrors(iPar) );
     if( error != 0 ) {
       //      std::cerr << "Minuit define parameter error: " << error << std::endl;
       throw MinuitError( error, "in DefineParameter" );
@@ -104,48 +683,90 @@ void MinuitSolver::setupParameters() {
 
 // Dtor:
 MinuitSolver::~MinuitSolver() {
-  delete m_minuit;
+  delete m_engine;
 }
 
 // Getters:
 stat_t MinuitSolver::getStat() const {
-  stat_t hstat;
-  m_minuit->mnstat( hstat.min, hstat.edm, hstat.errdef, 
-		    hstat.npari, hstat.nparx, hstat.status );
+  stat_t hstat= m_engine->getStat();
+  if( m_linearsolved ) {
+    hstat.min= m_linearchisq;
+    hstat.edm= 0.0;
+    hstat.status= 3;
+  }
   return hstat;
 }
 
-std::pair<TVectorD,TVectorD> MinuitSolver::getPars() const {
+// One pass over the minimiser, errors and covariances from an analytic
+// Hessian where available:
+const MinuitResult& MinuitSolver::getResult() const {
+  if( m_resultvalid ) return m_result;
+  stat_t hstat= getStat();
   int nPars= m_pars.GetNoElements();
   TVectorD pars( nPars );
   TVectorD parerrors( nPars );
   for( int iPar= 0; iPar < nPars; ++iPar ) {
-    int ierr= m_minuit->GetParameter( iPar, pars(iPar), parerrors(iPar) );
+    int ierr= m_engine->getParameter( iPar, pars(iPar), parerrors(iPar) );
     if( ierr < 0 ) {
       //      std::cerr << "Parameter " << iPar << " not defined!" << std::endl;
       throw MinuitError( ierr, "in GetParameter" );
     }
   }
-  return std::pair<TVectorD,TVectorD>( pars, parerrors );
-}
-
-TMatrixDSym MinuitSolver::getCovarianceMatrix() const {
-  int nPars= m_pars.GetNoElements();
+  if( m_linearsolved ) pars= m_linearpars;
   TMatrixDSym covmat( nPars );
-  m_minuit->mnemat( covmat.GetMatrixArray(), nPars );
-  return covmat;
+  if( getHessianCovariance( pars, hstat.errdef, covmat ) ) {
+    for( int iPar= 0; iPar < nPars; ++iPar ) {
+      parerrors(iPar)= sqrt( covmat(iPar,iPar) );
+    }
+  }
+  else {
+    m_engine->getCovariance( covmat.GetMatrixArray(), nPars );
+  }
+  m_result= MinuitResult( m_parnames, pars, parerrors, covmat, hstat, 
+			  m_ndof );
+  m_resultvalid= true;
+  return m_result;
 }
 
-TMatrixDSym MinuitSolver::getCorrelationMatrix() const {
-  int nPars= m_pars.GetNoElements();
-  TMatrixDSym covmat( getCovarianceMatrix() );
-  TMatrixDSym corrmat( nPars );
-  for( int i= 0; i < nPars; ++i ) {
-    for( int j= 0; j < nPars; ++j ) {
-      corrmat(i,j)= covmat(i,j)/sqrt(covmat(i,i)*covmat(j,j));
+// Covariance 2 errdef H^-1 of the free parameters, zero rows and columns
+// for fixed ones, false without Hessian:
+bool MinuitSolver::getHessianCovariance( const TVectorD& pars, 
+					 Double_t errdef,
+					 TMatrixDSym& covmat ) const {
+  if( not m_gradfunction ) return false;
+  Int_t nPars= pars.GetNoElements();
+  TMatrixDSym hessian( nPars );
+  if( not m_gradfunction->hessian( nPars, pars.GetMatrixArray(),
+				   hessian.GetMatrixArray() ) ) {
+    return false;
+  }
+  vector<Int_t> free;
+  for( Int_t iPar= 0; iPar < nPars; iPar++ ) {
+    if( m_linearsolved or not m_engine->isFixed( iPar ) ) {
+      free.push_back( iPar );
+    }
+  }
+  Int_t nFree= free.size();
+  TMatrixDSym freehessian( nFree );
+  for( Int_t iFree= 0; iFree < nFree; iFree++ ) {
+    for( Int_t jFree= 0; jFree < nFree; jFree++ ) {
+      freehessian(iFree,jFree)= hessian(free[iFree],free[jFree]);
     }
   }
-  return corrmat;
+  if( nFree > 0 ) {
+    Double_t det= 0.0;
+    freehessian.Invert( &det );
+    if( det == 0.0 ) return false;
+  }
+  covmat.ResizeTo( nPars, nPars );
+  covmat.Zero();
+  for( Int_t iFree= 0; iFree < nFree; iFree++ ) {
+    for( Int_t jFree= 0; jFree < nFree; jFree++ ) {
+      covmat(free[iFree],free[jFree])= 
+	2.0*errdef*freehessian(iFree,jFree);
+    }
+  }
+  return true;
 }
 
 //   print
@@ -165,12 +786,13 @@ void MinuitSolver::printResult( bool cov, bool cor, TString option ) const {
 }
 
 void MinuitSolver::printPars( TString option ) const {
+  const MinuitResult& result= getResult();
   vector<string>::const_iterator it_names= m_parnames.begin();
   int iparameter = 0;
   while( it_names != m_parnames.end() ) {
     std::cout << *it_names << "\t" << 
-      getPars().first( iparameter ) << "\t" << 
-      getPars().second( iparameter ) << std::endl;
+      result.getPars()( iparameter ) << "\t" << 
+      result.getParErrors()( iparameter ) << std::endl;
     it_names++;
     iparameter++;
   }
@@ -186,13 +808,83 @@ void MinuitSolver::printCorrelations() const {
   matrix.Print();
 }
 
+// LinearModel without iterations, MIGRAD if its normal equations fail:
+// The result snapshot is taken right away. The closed form solution is
+// also given to the minimiser, commands afterwards start from there:
 void MinuitSolver::solve() const {
-  minuitCommand( "MIGRAD" );
+  m_resultvalid= false;
+  m_linearsolved= false;
+  if( m_linearmodel and 
+      m_linearmodel->solve( m_linearpars, m_linearchisq ) ) {
+    setupParameters( m_linearpars );
+    m_linearsolved= true;
+  }
+  if( not m_linearsolved ) minuitCommand( "MIGRAD" );
+  getResult();
   return;
 }
 
+// SET GRAD 1 trusts the gradient without Minuit's own check, 
+// checkGradient does that on request:
+void MinuitSolver::useGradient( bool use ) const {
+  minuitCommand( use ? "SET GRAD 1" : "SET NOGRAD" );
+  return;
+}
+Double_t MinuitSolver::checkGradient( const TVectorD& pars ) const {
+  Int_t nPars= pars.GetNoElements();
+  vector<Double_t> point( pars.GetMatrixArray(), 
+			  pars.GetMatrixArray()+nPars );
+  vector<Double_t> grad( nPars );
+  vector<Double_t> dummy( nPars );
+  Double_t fval= 0.0;
+  m_engine->eval( nPars, &grad[0], fval, &point[0], 2 );
+  Double_t maxdiff= 0.0;
+  for( Int_t iPar= 0; iPar < nPars; iPar++ ) {
+    Double_t step= 1.0e-4*m_parerrors[iPar];
+    if( not ( step > 0.0 ) ) {
+      step= 1.0e-4*std::max( fabs( pars[iPar] ), 1.0 );
+    }
+    Double_t fup= 0.0;
+    Double_t fdown= 0.0;
+    point[iPar]= pars[iPar] + step;
+    m_engine->eval( nPars, &dummy[0], fup, &point[0], 4 );
+    point[iPar]= pars[iPar] - step;
+    m_engine->eval( nPars, &dummy[0], fdown, &point[0], 4 );
+    point[iPar]= pars[iPar];
+    Double_t numgrad= ( fup - fdown )/( 2.0*step );
+    Double_t diff= fabs( grad[iPar] - numgrad )/std::max( fabs( numgrad ), 
+							   1.0 );
+    maxdiff= std::max( maxdiff, diff );
+  }
+  return maxdiff;
+}
+
+// Commands which move the parameters or the minimum, abbreviated as
+// Minuit accepts them:
+static bool changesMinimum( const string& command ) {
+  string upper( command );
+  for( size_t ichar= 0; ichar < upper.size(); ichar++ ) {
+    upper[ichar]= toupper( upper[ichar] );
+  }
+  upper.erase( 0, upper.find_first_not_of( " " ) );
+  static const char* prefixes[]= { "MIG", "MIN", "SIM", "HES", "IMP", 
+				   "SEE", "SCA", "FIX", "REL", "RES", 
+				   "CLE", "CAL", "SET PAR", "SET LIM" };
+  for( size_t ipre= 0; ipre < sizeof(prefixes)/sizeof(prefixes[0]); 
+       ipre++ ) {
+    if( upper.compare( 0, strlen( prefixes[ipre] ), prefixes[ipre] ) == 0 ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Commands may change the minimiser state, the snapshot is taken again.
+// The closed form solution stays until a command changes the minimum:
 void MinuitSolver::minuitCommand( string command ) const {
-  Int_t error= m_minuit->Command( command.c_str() );
+  m_resultvalid= false;
+  if( changesMinimum( command ) ) m_linearsolved= false;
+  Int_t error= m_engine->command( command );
   if( error != 0 ) {
     // std::cerr << "Minuit command " << command << " failed: " 
     // 	      << error << std::endl;
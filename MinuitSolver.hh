@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include "TVectorD.h"
 #include "TMatrixD.h"
@@ -25,9 +26,96 @@ struct stat_t {
 // Interface for myTMinuit function objects:
 class MinuitSolverFunction {
 public:
+  virtual ~MinuitSolverFunction() {}
   virtual void operator()( Int_t&, Double_t*, Double_t&, Double_t*, Int_t )=0;
 };
 
+// Function objects with analytic gradient, MinuitSolver detects them 
+// and lets MIGRAD use the gradient instead of finite differences. The
+// optional Hessian (row-major npar x npar) gives the covariance matrix
+// at the minimum, hessian returns false if there is none:
+class MinuitSolverGradientFunction: public MinuitSolverFunction {
+public:
+  virtual Double_t value( Int_t npar, const Double_t* pars )=0;
+  virtual void gradient( Int_t npar, const Double_t* pars, 
+			 Double_t* grad )=0;
+  virtual bool hessian( Int_t npar, const Double_t* pars, Double_t* hess );
+  virtual void operator()( Int_t& npar, Double_t* grad, Double_t& fval, 
+			   Double_t* pars, Int_t iflag );
+};
+
+// chi^2= (y - A p)^T W (y - A p) with design matrix A (nres x npar),
+// data y and weights W, either diagonal or a full matrix. Constraint
+// terms p_k^2 are rows of A with data 0. MinuitSolver::solve finds the 
+// minimum directly from the normal equations A^T W A p= A^T W y. The
+// constructors throw std::invalid_argument unless y and W match the rows
+// of A, value and gradient for a wrong number of parameters:
+class LinearModel: public MinuitSolverGradientFunction {
+public:
+  LinearModel( const TMatrixD& design, const TVectorD& data, 
+	       const TVectorD& weights );
+  LinearModel( const TMatrixD& design, const TVectorD& data, 
+	       const TMatrixDSym& weightmatrix );
+  virtual Double_t value( Int_t npar, const Double_t* pars );
+  virtual void gradient( Int_t npar, const Double_t* pars, Double_t* grad );
+  virtual bool hessian( Int_t npar, const Double_t* pars, Double_t* hess );
+  // Minimum and chi^2 there, false if A^T W A is not positive definite:
+  bool solve( TVectorD& pars, Double_t& chisq ) const;
+private:
+  // Throw std::invalid_argument for inconsistent inputs:
+  void checkSizes( Int_t nweights ) const;
+  void checkNpar( Int_t npar ) const;
+  // r= y - A p and W r:
+  void residuals( const Double_t* pars, TVectorD& residuals, 
+		  TVectorD& weighted ) const;
+  // A^T W A:
+  TMatrixDSym normalMatrix() const;
+  TMatrixD m_design;
+  TVectorD m_data;
+  TVectorD m_weights;
+  TMatrixDSym m_weightmatrix;
+  bool m_diagonal;
+};
+
+// Results of a fit extracted once from the minimiser, immutable and 
+// copyable. write gives plain text with full precision, read restores 
+// the same result and throws for bad input:
+class MinuitResult {
+public:
+  MinuitResult();
+  MinuitResult( const std::vector<std::string>& parnames, 
+		const TVectorD& pars, const TVectorD& parerrors,
+		const TMatrixDSym& covariance, const stat_t& stat, int ndof );
+  // ROOT vectors and matrices only assign equal sizes:
+  MinuitResult& operator=( const MinuitResult& other );
+  const std::vector<std::string>& getParNames() const { return m_parnames; }
+  const TVectorD& getPars() const { return m_pars; }
+  const TVectorD& getParErrors() const { return m_parerrors; }
+  const TMatrixDSym& getCovarianceMatrix() const { return m_covariance; }
+  const TMatrixDSym& getCorrelationMatrix() const { return m_correlation; }
+  Double_t getChisq() const { return m_stat.min; }
+  Double_t getEdm() const { return m_stat.edm; }
+  Double_t getErrdef() const { return m_stat.errdef; }
+  Int_t getStatus() const { return m_stat.status; }
+  int getNdof() const { return m_ndof; }
+  void write( std::ostream& ost ) const;
+  static MinuitResult read( std::istream& ist );
+private:
+  std::vector<std::string> m_parnames;
+  TVectorD m_pars;
+  TVectorD m_parerrors;
+  TMatrixDSym m_covariance;
+  TMatrixDSym m_correlation;
+  stat_t m_stat;
+  int m_ndof;
+};
+
+// Minimiser behind MinuitSolver: TMinuit relies on the global gMinuit,
+// its fits are serialised by a process wide lock and may be started 
+// from any thread. Minuit2 (compiled in with AVERAGETOOLS_MINUIT2) keeps
+// all state per instance and fits run concurrently:
+enum MinuitEngineType { kTMinuit, kMinuit2 };
+class MinuitEngine;
 
 // Class to handle Minuit fits:
 class MinuitSolver {
@@ -39,26 +127,35 @@ public:
 		const std::vector<std::string>& parnames, 
 		const TVectorD& pars, 
 		const TVectorD& parerrors, 
-		int ndf, bool quiet=true, int maxpars=50 );
+		int ndf, bool quiet=true, int maxpars=50,
+		MinuitEngineType engine=kTMinuit );
 
   // Use with function objects:
   MinuitSolver( MinuitSolverFunction& msf, 
 		const std::vector<std::string>& parnames, 
 		const TVectorD& pars, 
 		const TVectorD& parerrors, 
-		int ndf, bool quiet=true, int maxpars=50 );
+		int ndf, bool quiet=true, int maxpars=50,
+		MinuitEngineType engine=kTMinuit );
 
   ~MinuitSolver();
 
   //getter
+  // Snapshot of the results, taken by solve or after minuitCommand on
+  // first use:
+  const MinuitResult& getResult() const;
   int getNdof() const { return m_ndof; }
-  TVectorD getUpar() const { return getPars().first; }
-  TVectorD getUparErrors() const { return getPars().second; }
+  TVectorD getUpar() const { return getResult().getPars(); }
+  TVectorD getUparErrors() const { return getResult().getParErrors(); }
   std::vector<std::string> getUparNames() const { return m_parnames; }
-  TMatrixDSym getCovarianceMatrix() const;
-  TMatrixDSym getCorrelationMatrix() const;
-  int getStatus() const { return getStat().status; }
-  double getChisq() const { return getStat().min; }
+  TMatrixDSym getCovarianceMatrix() const { 
+    return getResult().getCovarianceMatrix(); 
+  }
+  TMatrixDSym getCorrelationMatrix() const { 
+    return getResult().getCorrelationMatrix(); 
+  }
+  int getStatus() const { return getResult().getStatus(); }
+  double getChisq() const { return getResult().getChisq(); }
 
   //print
   void printResult( bool cov= false, bool cor= false, 
@@ -69,22 +166,39 @@ public:
   //other
   void solve() const;
   void minuitCommand( std::string cmd ) const;
+  // Gradient from a fcn which fills grad for iflag 2, automatic for 
+  // MinuitSolverGradientFunction:
+  void useGradient( bool use= true ) const;
+  // Largest difference of the gradient for iflag 2 from central 
+  // differences at pars, relative to the numeric gradient where that
+  // is larger than one. Steps are 1e-4 of the parameter errors, or of 
+  // the parameter values for zero errors:
+  Double_t checkGradient( const TVectorD& pars ) const;
   
 private:
 
-  std::pair<TVectorD,TVectorD> getPars() const;
   stat_t getStat() const;
   void printPars( TString option= ".4f" ) const;
   void checkMaxpars( Int_t maxpars );
-  void setupParameters();
+  void setupParameters( const TVectorD& pars ) const;
   void initialise( Int_t maxpars, bool quiet );
+  bool getHessianCovariance( const TVectorD& pars, Double_t errdef, 
+			     TMatrixDSym& cov ) const;
 
   std::vector<std::string> m_parnames;
   TVectorD m_pars;
   TVectorD m_parerrors;
   int m_ndof;
-  // Must be pointer due to non-constness of TMinuit:
-  TMinuit* m_minuit;
+  // Must be pointer due to non-constness of the minimisers:
+  MinuitEngine* m_engine;
+  MinuitSolverGradientFunction* m_gradfunction;
+  LinearModel* m_linearmodel;
+  // Closed form solution for LinearModel, MIGRAD results otherwise:
+  mutable bool m_linearsolved;
+  mutable TVectorD m_linearpars;
+  mutable Double_t m_linearchisq;
+  mutable MinuitResult m_result;
+  mutable bool m_resultvalid;
 
 };
 
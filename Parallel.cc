@@ -0,0 +1,64 @@
+
+#include "Parallel.hh"
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <functional>
+
+// Worker loop, first exception stops handing out indices and is rethrown
+// in the calling thread:
+class ParallelWorker {
+public:
+  ParallelWorker( size_t n, ParallelTask& task, std::atomic<size_t>& next,
+		  std::exception_ptr& error, std::atomic<bool>& failed ) :
+    m_n( n ), m_task( task ), m_next( next ), m_error( error ), 
+    m_failed( failed ) {}
+  void operator()( unsigned ithread ) {
+    try {
+      for( size_t index= m_next++; index < m_n and not m_failed; 
+	   index= m_next++ ) {
+	m_task( index, ithread );
+      }
+    }
+    catch( ... ) {
+      if( not m_failed.exchange( true ) ) m_error= std::current_exception();
+    }
+  }
+private:
+  size_t m_n;
+  ParallelTask& m_task;
+  std::atomic<size_t>& m_next;
+  std::exception_ptr& m_error;
+  std::atomic<bool>& m_failed;
+};
+
+unsigned defaultThreads() {
+  unsigned nthreads= std::thread::hardware_concurrency();
+  return nthreads > 0 ? nthreads : 1;
+}
+
+void parallelFor( size_t n, ParallelTask& task, unsigned nthreads ) {
+  if( nthreads == 0 ) nthreads= defaultThreads();
+  if( nthreads > n ) nthreads= n;
+  std::atomic<size_t> next( 0 );
+  std::atomic<bool> failed( false );
+  std::exception_ptr error;
+  ParallelWorker worker( n, task, next, error, failed );
+  if( nthreads <= 1 ) {
+    worker( 0 );
+  }
+  else {
+    std::vector<std::thread> threads;
+    for( unsigned ithread= 1; ithread < nthreads; ithread++ ) {
+      threads.push_back( std::thread( std::ref( worker ), ithread ) );
+    }
+    worker( 0 );
+    for( size_t ithread= 0; ithread < threads.size(); ithread++ ) {
+      threads[ithread].join();
+    }
+  }
+  if( error ) std::rethrow_exception( error );
+  return;
+}
@@ -0,0 +1,21 @@
+#ifndef PARALLEL_HH
+#define PARALLEL_HH
+
+#include <cstddef>
+
+// Interface for tasks run by parallelFor, operator() is called once for
+// each index with the number of the calling thread:
+class ParallelTask {
+public:
+  virtual ~ParallelTask() {}
+  virtual void operator()( size_t index, unsigned ithread )=0;
+};
+
+// Number of threads used for nthreads=0, i.e. all cores:
+unsigned defaultThreads();
+
+// Run task for indices 0 ... n-1 on nthreads threads, indices are handed
+// out one at a time so that slow indices do not leave threads idle:
+void parallelFor( size_t n, ParallelTask& task, unsigned nthreads=0 );
+
+#endif
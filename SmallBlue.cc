@@ -0,0 +1,27 @@
+#include "SmallBlue.hh"
+
+// Table of instances indexed by [nvar-1][navg-1]:
+typedef bool (*SmallCombiner)( const Double_t*, const Double_t*,
+			       const Int_t*, smallblue_t& );
+#define SMALLBLUE_ROW( N ) \
+  { &combineFixed<N,1>, &combineFixed<N,2>, &combineFixed<N,3> }
+static const SmallCombiner smallCombiners[maxSmallVar][maxSmallGroups]= {
+  SMALLBLUE_ROW( 1 ), SMALLBLUE_ROW( 2 ), SMALLBLUE_ROW( 3 ),
+  SMALLBLUE_ROW( 4 ), SMALLBLUE_ROW( 5 ), SMALLBLUE_ROW( 6 ),
+  SMALLBLUE_ROW( 7 ), SMALLBLUE_ROW( 8 ), SMALLBLUE_ROW( 9 ),
+  SMALLBLUE_ROW( 10 ) };
+#undef SMALLBLUE_ROW
+
+bool combineSmall( Int_t nvar, Int_t navg, const Double_t* values,
+		   const Double_t* covariance, const Int_t* groups,
+		   smallblue_t& result ) {
+  if( nvar < 1 or nvar > maxSmallVar or navg < 1 or
+      navg > maxSmallGroups ) {
+    return false;
+  }
+  for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+    if( groups[ivar] < 0 or groups[ivar] >= navg ) return false;
+  }
+  return smallCombiners[nvar-1][navg-1]( values, covariance, groups,
+					 result );
+}
@@ -0,0 +1,137 @@
+#ifndef SMALLBLUE_HH
+#define SMALLBLUE_HH
+
+#include <cmath>
+
+#include "Rtypes.h"
+
+// Fixed size BLUE for small combinations without ROOT matrices, maps or
+// heap allocations: N measurements with covariance V (N x N, row-major)
+// in M groups. All arrays have sizes known at compile time and live on
+// the stack, loops have constant bounds and are unrolled by the
+// compiler. combineSmall picks the instance matching the input size:
+const Int_t maxSmallVar= 10;
+const Int_t maxSmallGroups= 3;
+
+// Results of a small combination, only the first navg rows and nvar
+// columns are used. valid is false when V or G^T V^-1 G is not
+// positive definite:
+struct smallblue_t {
+  Int_t nvar;
+  Int_t navg;
+  Double_t average[maxSmallGroups];
+  Double_t avgcov[maxSmallGroups][maxSmallGroups];
+  Double_t weights[maxSmallGroups][maxSmallVar];
+  Double_t chisq;
+  bool valid;
+};
+
+// Cholesky decomposition A= L L^T in place, lower triangle only:
+template< Int_t N >
+bool choleskyFixed( Double_t (&matrix)[N][N] ) {
+  for( Int_t i= 0; i < N; i++ ) {
+    for( Int_t j= 0; j <= i; j++ ) {
+      Double_t sum= matrix[i][j];
+      for( Int_t k= 0; k < j; k++ ) sum-= matrix[i][k]*matrix[j][k];
+      if( i == j ) {
+	if( not ( sum > 0.0 ) ) return false;
+	matrix[i][i]= std::sqrt( sum );
+      }
+      else {
+	matrix[i][j]= sum/matrix[j][j];
+      }
+    }
+  }
+  return true;
+}
+
+// Replace b by A^-1 b with L from choleskyFixed:
+template< Int_t N >
+void solveFixed( const Double_t (&lower)[N][N], Double_t (&bvector)[N] ) {
+  for( Int_t i= 0; i < N; i++ ) {
+    Double_t sum= bvector[i];
+    for( Int_t k= 0; k < i; k++ ) sum-= lower[i][k]*bvector[k];
+    bvector[i]= sum/lower[i][i];
+  }
+  for( Int_t i= N-1; i >= 0; i-- ) {
+    Double_t sum= bvector[i];
+    for( Int_t k= i+1; k < N; k++ ) sum-= lower[k][i]*bvector[k];
+    bvector[i]= sum/lower[i][i];
+  }
+  return;
+}
+
+// W= (G^T V^-1 G)^-1 G^T V^-1, average W y, covariance of the averages
+// (G^T V^-1 G)^-1 and chi^2= y^T V^-1 y - average^T G^T V^-1 y. Group
+// indices index stack arrays and must be 0 ... M-1, combineSmall checks:
+template< Int_t N, Int_t M >
+bool combineFixed( const Double_t* values, const Double_t* covariance,
+		   const Int_t* groups, smallblue_t& result ) {
+  result.nvar= N;
+  result.navg= M;
+  result.valid= false;
+  Double_t lower[N][N];
+  for( Int_t i= 0; i < N; i++ ) {
+    for( Int_t j= 0; j < N; j++ ) lower[i][j]= covariance[i*N+j];
+  }
+  if( not choleskyFixed( lower ) ) return true;
+  Double_t vinvgm[M][N];
+  for( Int_t iavg= 0; iavg < M; iavg++ ) {
+    for( Int_t i= 0; i < N; i++ ) vinvgm[iavg][i]= groups[i] == iavg;
+    solveFixed( lower, vinvgm[iavg] );
+  }
+  Double_t vinvdata[N];
+  for( Int_t i= 0; i < N; i++ ) vinvdata[i]= values[i];
+  solveFixed( lower, vinvdata );
+  Double_t utvinvu[M][M];
+  Double_t utvinvdata[M];
+  for( Int_t iavg= 0; iavg < M; iavg++ ) {
+    for( Int_t javg= 0; javg < M; javg++ ) utvinvu[iavg][javg]= 0.0;
+    utvinvdata[iavg]= 0.0;
+  }
+  for( Int_t i= 0; i < N; i++ ) {
+    Int_t igroup= groups[i];
+    for( Int_t javg= 0; javg < M; javg++ ) {
+      utvinvu[igroup][javg]+= vinvgm[javg][i];
+    }
+    utvinvdata[igroup]+= vinvdata[i];
+  }
+  if( not choleskyFixed( utvinvu ) ) return true;
+  Double_t chisq= 0.0;
+  for( Int_t i= 0; i < N; i++ ) chisq+= values[i]*vinvdata[i];
+  Double_t average[M];
+  for( Int_t iavg= 0; iavg < M; iavg++ ) average[iavg]= utvinvdata[iavg];
+  solveFixed( utvinvu, average );
+  for( Int_t iavg= 0; iavg < M; iavg++ ) {
+    result.average[iavg]= average[iavg];
+    chisq-= average[iavg]*utvinvdata[iavg];
+    Double_t unit[M];
+    for( Int_t javg= 0; javg < M; javg++ ) unit[javg]= iavg == javg;
+    solveFixed( utvinvu, unit );
+    for( Int_t javg= 0; javg < M; javg++ ) {
+      result.avgcov[iavg][javg]= unit[javg];
+    }
+  }
+  for( Int_t iavg= 0; iavg < M; iavg++ ) {
+    for( Int_t i= 0; i < N; i++ ) {
+      Double_t sum= 0.0;
+      for( Int_t javg= 0; javg < M; javg++ ) {
+	sum+= result.avgcov[iavg][javg]*vinvgm[javg][i];
+      }
+      result.weights[iavg][i]= sum;
+    }
+  }
+  result.chisq= chisq;
+  result.valid= true;
+  return true;
+}
+
+// Runtime dispatch to combineFixed<nvar,navg>, returns false without
+// touching result if nvar or navg are larger than supported, the
+// caller then uses Blue. Group indices must be 0 ... navg-1, else the
+// result is false as well:
+bool combineSmall( Int_t nvar, Int_t navg, const Double_t* values,
+		   const Double_t* covariance, const Int_t* groups,
+		   smallblue_t& result );
+
+#endif
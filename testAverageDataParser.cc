@@ -6,6 +6,8 @@
 
 #include <iostream>
 #include <sstream>
+#include <fstream>
+#include <cstdio>
 #include <string>
 #include <vector>
 #include <map>
@@ -151,6 +153,18 @@ BOOST_AUTO_TEST_CASE( testgetCovoption ) {
   checkStringMap( covopts, expectedcovopts );
 }
 
+BOOST_AUTO_TEST_CASE( testgetCovoptionTypes ) {
+  BOOST_MESSAGE( "testgetCovoptionTypes" );
+  const CovoptionMap& covtypes= parser.getCovoptionTypes();
+  BOOST_CHECK_EQUAL( covtypes.size(), size_t( 5 ) );
+  BOOST_CHECK_EQUAL( covtypes.find( "00stat" )->second.type, 
+		     kCorrelationMatrix );
+  BOOST_CHECK_EQUAL( covtypes.find( "01err1" )->second.type, kLetterMatrix );
+  BOOST_CHECK_EQUAL( covtypes.find( "03err3" )->second.type, kPartial );
+  BOOST_CHECK_EQUAL( covtypes.find( "04err4" )->second.type, kFull );
+  BOOST_CHECK( not covtypes.find( "04err4" )->second.relative );
+}
+
 BOOST_AUTO_TEST_CASE( testgetCorrelations ) {
   BOOST_MESSAGE( "testgetCorrelations" );
   map<string, string > correlations= parser.getCorrelations();
@@ -164,6 +178,20 @@ BOOST_AUTO_TEST_CASE( testgetCorrelations ) {
   checkStringMap( correlations, expectedcorrelations );
 }
 
+BOOST_AUTO_TEST_CASE( testgetCorrelationMatrices ) {
+  BOOST_MESSAGE( "testgetCorrelationMatrices" );
+  const CorrelationMap& corrmatrices= parser.getCorrelationMatrices();
+  BOOST_CHECK_EQUAL( corrmatrices.size(), size_t( 1 ) );
+  const TMatrixD& corrmatrix= corrmatrices.find( "00stat" )->second;
+  BOOST_CHECK_EQUAL( corrmatrix(1,1), 1.0 );
+  BOOST_CHECK_EQUAL( corrmatrix(1,2), 0.0 );
+  const LetterMatrixMap& lettermatrices= parser.getLetterMatrices();
+  BOOST_CHECK_EQUAL( lettermatrices.size(), size_t( 2 ) );
+  const LetterMatrix& letters= lettermatrices.find( "01err1" )->second;
+  BOOST_CHECK_EQUAL( letters.size(), size_t( 9 ) );
+  BOOST_CHECK_EQUAL( letters[4], kPartial );
+}
+
 BOOST_AUTO_TEST_CASE( testgetCovariances ) {
   BOOST_MESSAGE( "testgetCovariances" );
   map<string,TMatrixDSym> covariances= parser.getCovariances();
@@ -249,6 +277,115 @@ BOOST_AUTO_TEST_CASE( testgetTotalReducedCovariances ) {
   checkMatrix( totalredcov, expectedtrc );
 }
 
+BOOST_AUTO_TEST_CASE( testCache ) {
+  BOOST_MESSAGE( "testCache" );
+  string cachename= "test.txt.cache";
+  std::remove( cachename.c_str() );
+  AverageDataParser written( "test.txt", cachename );
+  AverageDataParser cached( "test.txt", cachename );
+  BOOST_CHECK( cached.getNames() == parser.getNames() );
+  checkVector( cached.getValues(), parser.getValues() );
+  checkVectorMap( cached.getErrors(), parser.getErrors() );
+  checkStringMap( cached.getCovoption(), parser.getCovoption() );
+  checkStringMap( cached.getCorrelations(), parser.getCorrelations() );
+  checkMatrixMap( cached.getCovariances(), parser.getCovariances() );
+  checkMatrixMap( cached.getReducedCovariances(), 
+		  parser.getReducedCovariances() );
+  checkMatrix( cached.getGroupMatrix(), parser.getGroupMatrix() );
+  checkVector( cached.getTotalErrors(), parser.getTotalErrors() );
+  BOOST_CHECK_EQUAL( cached.getSysterrorMatrix().size(), 
+		     parser.getSysterrorMatrix().size() );
+  // A truncated cache is ignored and rewritten:
+  std::ofstream truncated( cachename.c_str(), 
+			   std::ios::binary | std::ios::trunc );
+  truncated << "RATcache";
+  truncated.close();
+  AverageDataParser reparsed( "test.txt", cachename );
+  checkMatrixMap( reparsed.getCovariances(), parser.getCovariances() );
+  std::remove( cachename.c_str() );
+}
+
+// Cache with the 4 byte size field at offset replaced by value:
+static void writeCorruptCache( const string& cache, size_t offset, 
+			       UInt_t value, const string& cachename ) {
+  string corrupt( cache );
+  corrupt.replace( offset, sizeof(value), 
+		   reinterpret_cast<const char*>( &value ), sizeof(value) );
+  std::ofstream cachefile( cachename.c_str(), 
+			   std::ios::binary | std::ios::trunc );
+  cachefile.write( corrupt.data(), corrupt.size() );
+}
+
+// Corrupt size fields are rejected before allocation and the input is 
+// parsed again. The first vector follows magic, version, hash, file 
+// size and the names, matrices are found by their 3 x 3 shape:
+BOOST_AUTO_TEST_CASE( testCacheCorruptSizes ) {
+  BOOST_MESSAGE( "testCacheCorruptSizes" );
+  string cachename= "test.txt.cache";
+  std::remove( cachename.c_str() );
+  AverageDataParser written( "test.txt", cachename );
+  std::ifstream cachefile( cachename.c_str(), std::ios::binary );
+  std::stringstream sstr;
+  sstr << cachefile.rdbuf();
+  string cache= sstr.str();
+  vector<size_t> offsets;
+  vector<UInt_t> values;
+  size_t valuesoffset= 8 + 4 + 8 + 8 + 4;
+  const vector<string>& names= parser.getNames();
+  for( size_t iname= 0; iname < names.size(); iname++ ) {
+    valuesoffset+= 4 + names[iname].size();
+  }
+  offsets.push_back( valuesoffset );
+  values.push_back( 0xffffffff );
+  UInt_t shape[2]= { 3, 3 };
+  string shapebytes( reinterpret_cast<const char*>( shape ), sizeof(shape) );
+  size_t nmatrices= 0;
+  for( size_t pos= cache.find( shapebytes ); pos != string::npos;
+       pos= cache.find( shapebytes, pos+1 ) ) {
+    offsets.push_back( pos );
+    values.push_back( 0xffffffff );
+    offsets.push_back( pos+4 );
+    values.push_back( 0x40000000 );
+    offsets.push_back( pos+4 );
+    values.push_back( 4 );
+    nmatrices++;
+  }
+  BOOST_CHECK( nmatrices > 0 );
+  for( size_t icorrupt= 0; icorrupt < offsets.size(); icorrupt++ ) {
+    writeCorruptCache( cache, offsets[icorrupt], values[icorrupt], 
+		       cachename );
+    AverageDataParser reparsed( "test.txt", cachename );
+    checkVector( reparsed.getValues(), parser.getValues() );
+    checkMatrixMap( reparsed.getCovariances(), parser.getCovariances() );
+  }
+  std::remove( cachename.c_str() );
+}
+
+// A cache with one name less reads to the end but its vectors do not 
+// match the number of names, it is rejected as well:
+BOOST_AUTO_TEST_CASE( testCacheInconsistentSizes ) {
+  BOOST_MESSAGE( "testCacheInconsistentSizes" );
+  string cachename= "test.txt.cache";
+  std::remove( cachename.c_str() );
+  AverageDataParser written( "test.txt", cachename );
+  std::ifstream cachefile( cachename.c_str(), std::ios::binary );
+  std::stringstream sstr;
+  sstr << cachefile.rdbuf();
+  string cache= sstr.str();
+  size_t namesoffset= 8 + 4 + 8 + 8;
+  const vector<string>& names= parser.getNames();
+  size_t lastoffset= namesoffset + 4;
+  for( size_t iname= 0; iname < names.size()-1; iname++ ) {
+    lastoffset+= 4 + names[iname].size();
+  }
+  cache.erase( lastoffset, 4 + names.back().size() );
+  writeCorruptCache( cache, namesoffset, names.size()-1, cachename );
+  AverageDataParser reparsed( "test.txt", cachename );
+  BOOST_CHECK( reparsed.getNames() == parser.getNames() );
+  checkMatrixMap( reparsed.getCovariances(), parser.getCovariances() );
+  std::remove( cachename.c_str() );
+}
+
 BOOST_AUTO_TEST_CASE( testprintFilename ) {
   BOOST_MESSAGE( "testprintFilename" );
   parser.printFilename( osst );
@@ -416,6 +553,144 @@ BOOST_AUTO_TEST_CASE( testOptionPercentU ) {
   checkMatrix( obtainedcovm, expectedcovm );
 }
 
+BOOST_AUTO_TEST_CASE( testMutators ) {
+  BOOST_MESSAGE( "testMutators" );
+  AverageDataParser parser( "test.txt" );
+  parser.setValue( 2, 175.0 );
+  parser.setError( "03err3", 1, 2.0 );
+  parser.setCorrelation( "00stat", 0, 1, 0.5 );
+  TVectorD err5( 3 );
+  err5[0]= 0.5;
+  err5[1]= 0.6;
+  err5[2]= 0.7;
+  parser.addErrorSource( "05err5", err5, "u" );
+  parser.removeErrorSource( "04err4" );
+  BOOST_CHECK_THROW( parser.setCorrelation( "03err3", 0, 1, 0.5 ), 
+		     std::exception );
+  values[2]= 175.0;
+  AverageDataParser original( "test.txt" );
+  errorsmap= original.getErrors();
+  errorsmap.erase( "04err4" );
+  errorsmap["03err3"][1]= 2.0;
+  errorsmap["05err5"].ResizeTo( err5 );
+  errorsmap["05err5"]= err5;
+  covopts["00stat"]= "c";
+  covopts["01err1"]= "m";
+  covopts["02err2"]= "m";
+  covopts["03err3"]= "p";
+  covopts["05err5"]= "u";
+  map<string,string> correlations;
+  correlations["00stat"]= "1 0.5 0 0.5 1 0 0 0 1";
+  correlations["01err1"]= "p p p p p p p p p";
+  correlations["02err2"]= "f f f f f f f f f";
+  AverageDataParser expected( names, values, errorsmap, covopts, 
+			      correlations );
+  checkVector( parser.getValues(), expected.getValues() );
+  checkMatrixMap( parser.getCovariances(), expected.getCovariances() );
+  checkMatrixMap( parser.getReducedCovariances(), 
+		  expected.getReducedCovariances() );
+  checkStringMap( parser.getCorrelations(), expected.getCorrelations() );
+  checkVector( parser.getTotalErrors(), expected.getTotalErrors() );
+  BOOST_CHECK_EQUAL( parser.getSysterrorMatrix().size(), 
+		     expected.getSysterrorMatrix().size() );
+  BOOST_CHECK_EQUAL( parser.getSysterrorMatrix().begin()->first,
+		     expected.getSysterrorMatrix().begin()->first );
+}
+
+// Correlation strings are made on request, as in the file for unchanged
+// sources and from the matrices for changed ones:
+BOOST_AUTO_TEST_CASE( testCorrelationStrings ) {
+  BOOST_MESSAGE( "testCorrelationStrings" );
+  AverageDataParser parser( "test.txt" );
+  parser.setCorrelation( "00stat", 0, 1, 0.5 );
+  const StringMap& correlations= parser.getCorrelations();
+  BOOST_CHECK_EQUAL( correlations.find( "00stat" )->second, 
+		     "1 0.5 0 0.5 1 0 0 0 1" );
+  BOOST_CHECK_EQUAL( correlations.find( "01err1" )->second, 
+		     "p p p p p p p p p" );
+  parser.setCorrelation( "00stat", 0, 1, 0.0 );
+  BOOST_CHECK_EQUAL( parser.getCorrelations().find( "00stat" )->second, 
+		     "1 0 0 0 1 0 0 0 1" );
+}
+
+// Failed additions leave the parser unchanged, the same source can be 
+// added again:
+BOOST_AUTO_TEST_CASE( testAddErrorSourceFailure ) {
+  BOOST_MESSAGE( "testAddErrorSourceFailure" );
+  AverageDataParser parser( "test.txt" );
+  AverageDataParser original( "test.txt" );
+  TVectorD err5( 3 );
+  err5[0]= 0.5;
+  err5[1]= 0.6;
+  err5[2]= 0.7;
+  BOOST_CHECK_THROW( parser.addErrorSource( "05err5", err5, "c", "1 0 0" ),
+		     std::exception );
+  BOOST_CHECK_THROW( parser.addErrorSource( "05err5", err5, "m", "u u u" ),
+		     std::exception );
+  BOOST_CHECK_THROW( parser.addErrorSource( "05err5", err5, "x" ),
+		     std::exception );
+  BOOST_CHECK_EQUAL( parser.getErrors().size(), original.getErrors().size() );
+  checkStringMap( parser.getCovoption(), original.getCovoption() );
+  BOOST_CHECK_EQUAL( parser.getCovarianceSources().size(), 
+		     original.getCovarianceSources().size() );
+  BOOST_CHECK( parser.getCovoptionTypes().find( "05err5" ) ==
+	       parser.getCovoptionTypes().end() );
+  BOOST_CHECK( parser.getCorrelationMatrices().find( "05err5" ) ==
+	       parser.getCorrelationMatrices().end() );
+  BOOST_CHECK( parser.getLetterMatrices().find( "05err5" ) ==
+	       parser.getLetterMatrices().end() );
+  parser.addErrorSource( "05err5", err5, "c", "1 0 0 0 1 0 0 0 1" );
+  TMatrixDSym total= original.getTotalCovariances();
+  for( Int_t ivar= 0; ivar < 3; ivar++ ) {
+    total(ivar,ivar)+= err5[ivar]*err5[ivar];
+  }
+  checkMatrix( parser.getTotalCovariances(), total );
+  BOOST_CHECK_THROW( parser.setCorrelation( "05err5", 1, 1, 0.5 ), 
+		     std::exception );
+}
+
+BOOST_AUTO_TEST_CASE( testAddRemoveMeasurement ) {
+  BOOST_MESSAGE( "testAddRemoveMeasurement" );
+  AverageDataParser parser( "test.txt" );
+  AverageDataParser original( "test.txt" );
+  parser.removeMeasurement( 2 );
+  BOOST_CHECK_EQUAL( parser.getValues().GetNoElements(), 2 );
+  BOOST_CHECK_EQUAL( parser.getCorrelations().find( "01err1" )->second, 
+		     "p p p p" );
+  ValueMap errors;
+  const VectorMap& originalerrors= original.getErrors();
+  for( VectorMap::const_iterator itr= originalerrors.begin();
+       itr != originalerrors.end(); itr++ ) {
+    errors[itr->first]= itr->second[2];
+  }
+  StringMap correlations;
+  correlations["00stat"]= "0 0 1";
+  correlations["01err1"]= "p p p";
+  correlations["02err2"]= "f f f";
+  parser.addMeasurement( "Val3", 174.5, errors, correlations );
+  checkVector( parser.getValues(), original.getValues() );
+  checkMatrixMap( parser.getCovariances(), original.getCovariances() );
+  // Strings of changed sources are made from the matrices:
+  const CorrelationMap& corrmatrices= parser.getCorrelationMatrices();
+  const CorrelationMap& originalcorrmatrices= 
+    original.getCorrelationMatrices();
+  BOOST_CHECK_EQUAL( corrmatrices.size(), originalcorrmatrices.size() );
+  for( CorrelationMap::const_iterator itr= originalcorrmatrices.begin();
+       itr != originalcorrmatrices.end(); itr++ ) {
+    checkMatrix( corrmatrices.find( itr->first )->second, itr->second );
+  }
+  BOOST_CHECK( parser.getLetterMatrices() == original.getLetterMatrices() );
+  BOOST_CHECK_EQUAL( parser.getCorrelations().find( "00stat" )->second,
+		     "1 0 0 0 1 0 0 0 1" );
+  checkVector( parser.getTotalErrors(), original.getTotalErrors() );
+  BOOST_CHECK_EQUAL( parser.getGroupMap().getNvar(), 3 );
+  correlations["03err3"]= "0 0";
+  BOOST_CHECK_THROW( parser.addMeasurement( "Val4", 1.0, errors, 
+					    correlations ),
+		     std::exception );
+  BOOST_CHECK_THROW( parser.removeMeasurement( 3 ), std::exception );
+}
+
 BOOST_AUTO_TEST_CASE( testOptionGP ) {
   BOOST_MESSAGE( "testOptionGP" );
   Double_t dataerrs[]= { 0.9, 1.5, 1.9 };
@@ -519,4 +794,21 @@ BOOST_AUTO_TEST_CASE( testGetGroupMatrix ) {
   checkMatrix( groupmatrix, expectedgm );
 }
 
+BOOST_AUTO_TEST_CASE( testGetGroupMap ) {
+  BOOST_MESSAGE( "testGetGroupMap" );
+  const GroupMap& groups= parser.getGroupMap();
+  BOOST_CHECK_EQUAL( groups.getNgroups(), 2 );
+  BOOST_CHECK_EQUAL( groups.getNvar(), 4 );
+  BOOST_CHECK_EQUAL( groups[1], 0 );
+  BOOST_CHECK_EQUAL( groups[2], 1 );
+  Double_t avgdata[]= { 1.0, 2.0 };
+  TVectorD averages( 2, avgdata );
+  Double_t expandeddata[]= { 1.0, 1.0, 2.0, 2.0 };
+  checkVector( groups.expand( averages ), TVectorD( 4, expandeddata ) );
+  Double_t sumdata[]= { 3.0, 7.0 };
+  TVectorD values( 4 );
+  for( Int_t ivar= 0; ivar < 4; ivar++ ) values[ivar]= ivar+1.0;
+  checkVector( groups.sum( values ), TVectorD( 2, sumdata ) );
+}
+
 BOOST_AUTO_TEST_SUITE_END()
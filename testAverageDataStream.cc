@@ -0,0 +1,60 @@
+// Unit tests for AverageDataStream
+
+#include "AverageDataStream.hh"
+#include "Blue.hh"
+
+// C++:
+#include <string>
+#include <exception>
+
+// BOOST test stuff:
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE averagedatastreamtests
+#include <boost/test/unit_test.hpp>
+
+// Namespaces:
+using std::string;
+
+class AverageDataStreamTestFixture {
+public:
+  AverageDataStreamTestFixture() : stream( "testMulti.txt" ) {}
+  AverageDataStream stream;
+};
+
+BOOST_FIXTURE_TEST_SUITE( averagedatastreamsuite, 
+			  AverageDataStreamTestFixture )
+
+BOOST_AUTO_TEST_CASE( testsize ) {
+  BOOST_MESSAGE( "testsize" );
+  BOOST_CHECK_EQUAL( stream.size(), size_t( 2 ) );
+  AverageDataStream single( "test.txt" );
+  BOOST_CHECK_EQUAL( single.size(), size_t( 1 ) );
+}
+
+BOOST_AUTO_TEST_CASE( testnext ) {
+  BOOST_MESSAGE( "testnext" );
+  BOOST_CHECK( stream.hasNext() );
+  AverageDataParser first= stream.next();
+  AverageDataParser expectedfirst( "valassi1.txt" );
+  BOOST_CHECK( first.getNames() == expectedfirst.getNames() );
+  BOOST_CHECK_EQUAL( first.getUniqueGroups().size(), size_t( 2 ) );
+  BOOST_CHECK_CLOSE( first.getTotalCovariances()(1,1), 9.0, 1.0e-6 );
+  AverageDataParser second= stream.next();
+  BOOST_CHECK_EQUAL( second.getErrors().size(), size_t( 5 ) );
+  BOOST_CHECK( not stream.hasNext() );
+  BOOST_CHECK_THROW( stream.next(), std::exception );
+  stream.rewind();
+  BOOST_CHECK( stream.hasNext() );
+}
+
+BOOST_AUTO_TEST_CASE( testBlue ) {
+  BOOST_MESSAGE( "testBlue" );
+  stream.next();
+  Blue blue( stream.next() );
+  Blue expected( "test.txt" );
+  BOOST_CHECK_CLOSE( blue.getAverage()[0], expected.getAverage()[0], 
+		     1.0e-6 );
+  BOOST_CHECK_CLOSE( blue.getChisq(), expected.getChisq(), 1.0e-6 );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
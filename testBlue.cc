@@ -89,8 +89,312 @@ BOOST_AUTO_TEST_CASE( testgetErrors ) {
   }
 }
 
+BOOST_AUTO_TEST_CASE( testgetTotalErrors ) {
+  BOOST_MESSAGE( "testgetTotalErrors" );
+  TVectorD obtained= blue.getTotalErrors();
+  BOOST_CHECK_EQUAL( obtained.GetNoElements(), 1 );
+  BOOST_CHECK_CLOSE( obtained[0], 2.9668615983552984, 1.0e-4 );
+}
+
+BOOST_AUTO_TEST_CASE( testcombineBatch ) {
+  BOOST_MESSAGE( "testcombineBatch" );
+  Double_t data[]= { 171.5, 172.5,
+		     173.1, 174.1,
+		     174.5, 175.5 };
+  TMatrixD values( 3, 2, data );
+  batch_t obtained= blue.combineBatch( values );
+  TVectorD pulls= blue.getPulls();
+  for( Int_t ibatch= 0; ibatch < 2; ibatch++ ) {
+    BOOST_CHECK_CLOSE( obtained.averages(0,ibatch), 170.709197+ibatch, 
+		       1.0e-4 );
+    BOOST_CHECK_CLOSE( obtained.chisq[ibatch], 0.770025, 1.0e-4 );
+    for( Int_t ivar= 0; ivar < 3; ivar++ ) {
+      BOOST_CHECK_CLOSE( obtained.pulls(ivar,ibatch), pulls[ivar], 1.0e-4 );
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( testjackknife ) {
+  BOOST_MESSAGE( "testjackknife" );
+  jackknife_t obtained= blue.jackknife();
+  Double_t expectedaverages[]= { 172.48991792, 170.65980630, 170.92848338 };
+  Double_t expectederrors[]= { 4.62054059, 2.97626880, 2.98649383 };
+  Double_t expectedchisq[]= { 0.51730054, 0.72639225, 0.35859866 };
+  for( Int_t ivar= 0; ivar < 3; ivar++ ) {
+    BOOST_CHECK( obtained.valid[ivar] );
+    BOOST_CHECK_CLOSE( obtained.averages(ivar,0), expectedaverages[ivar], 
+		       1.0e-4 );
+    BOOST_CHECK_CLOSE( obtained.errors(ivar,0), expectederrors[ivar], 
+		       1.0e-4 );
+    BOOST_CHECK_CLOSE( obtained.chisq[ivar], expectedchisq[ivar], 1.0e-4 );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( testscanCorrelation ) {
+  BOOST_MESSAGE( "testscanCorrelation" );
+  Double_t rhodata[]= { 0.0, 0.5, 1.0 };
+  TVectorD rhos( 3, rhodata );
+  scan_t obtained= blue.scanCorrelation( "04err4", rhos );
+  Double_t expectedaverages[]= { 171.71483230, 171.29491618, 170.70919692 };
+  Double_t expectederrors[]= { 3.10952280, 3.12263834, 2.96686160 };
+  Double_t expectedchisq[]= { 0.44678874, 0.53970347, 0.77002509 };
+  for( Int_t i= 0; i < 3; i++ ) {
+    BOOST_CHECK( obtained.valid[i] );
+    BOOST_CHECK_CLOSE( obtained.rhos(i,0), rhodata[i], 1.0e-4 );
+    BOOST_CHECK_CLOSE( obtained.averages(i,0), expectedaverages[i], 1.0e-4 );
+    BOOST_CHECK_CLOSE( obtained.errors(i,0), expectederrors[i], 1.0e-4 );
+    BOOST_CHECK_CLOSE( obtained.chisq[i], expectedchisq[i], 1.0e-4 );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( testscanCorrelations ) {
+  BOOST_MESSAGE( "testscanCorrelations" );
+  Double_t rhodata[]= { 0.0, 1.0 };
+  vector<corrscan_t> sources( 2 );
+  sources[0].errorkey= "02err2";
+  sources[0].rhos.ResizeTo( 2 );
+  sources[0].rhos.SetElements( rhodata );
+  sources[1].errorkey= "04err4";
+  sources[1].rhos.ResizeTo( 2 );
+  sources[1].rhos.SetElements( rhodata );
+  scan_t obtained= blue.scanCorrelations( sources );
+  BOOST_CHECK_EQUAL( obtained.chisq.GetNoElements(), 4 );
+  BOOST_CHECK_CLOSE( obtained.averages(0,0), 171.93730724, 1.0e-4 );
+  BOOST_CHECK_CLOSE( obtained.chisq[0], 0.39363184, 1.0e-4 );
+  BOOST_CHECK_CLOSE( obtained.rhos(1,1), 1.0, 1.0e-4 );
+  BOOST_CHECK_CLOSE( obtained.averages(1,0), 171.16251849, 1.0e-4 );
+  BOOST_CHECK_CLOSE( obtained.averages(3,0), 170.70919692, 1.0e-4 );
+  BOOST_CHECK_CLOSE( obtained.errors(3,0), 2.96686160, 1.0e-4 );
+}
+
+// Correlations making the total covariance not positive definite, for
+// rho= 5 the capacitance matrix has two negative eigenvalues and a 
+// positive determinant:
+BOOST_AUTO_TEST_CASE( testscanCorrelationNotPosDef ) {
+  BOOST_MESSAGE( "testscanCorrelationNotPosDef" );
+  Double_t rhodata[]= { -2.0, -5.0, 3.0, 5.0, 10.0 };
+  bool expectedvalid[]= { true, false, false, false, false };
+  TVectorD rhos( 5, rhodata );
+  scan_t obtained= blue.scanCorrelation( "04err4", rhos );
+  for( Int_t i= 0; i < 5; i++ ) {
+    BOOST_CHECK_EQUAL( obtained.valid[i], expectedvalid[i] );
+  }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
+// Blue input tests:
+
+BOOST_AUTO_TEST_CASE( testNotPositiveDefinite ) {
+  BOOST_MESSAGE( "testNotPositiveDefinite" );
+  BOOST_CHECK_THROW( Blue blue( "testNotPosDef.txt" ), std::exception );
+}
+
+// Diagonal plus rank-one sources solved with the Woodbury identity
+// agree with the same inputs given as dense matrices:
+BOOST_AUTO_TEST_CASE( testStructuredSources ) {
+  BOOST_MESSAGE( "testStructuredSources" );
+  Blue structured( "testStructured.txt" );
+  Blue dense( "testStructuredDense.txt" );
+  const TMatrixD& wm= structured.getWeightsMatrix();
+  const TMatrixD& wmdense= dense.getWeightsMatrix();
+  for( Int_t ivar= 0; ivar < wm.GetNcols(); ivar++ ) {
+    BOOST_CHECK_CLOSE( wm(0,ivar), wmdense(0,ivar), 1.0e-6 );
+  }
+  BOOST_CHECK_CLOSE( structured.getAverage()[0], dense.getAverage()[0], 
+		     1.0e-6 );
+  BOOST_CHECK_CLOSE( structured.getChisq(), dense.getChisq(), 1.0e-6 );
+  const MatrixMap& errors= structured.getErrors();
+  const MatrixMap& errorsdense= dense.getErrors();
+  BOOST_CHECK_CLOSE( errors.find( "01err1" )->second(0,0),
+		     errorsdense.find( "01err1" )->second(0,0), 1.0e-6 );
+  BOOST_CHECK_CLOSE( errors.find( "total" )->second(0,0),
+		     errorsdense.find( "total" )->second(0,0), 1.0e-6 );
+  jackknife_t jackknife= structured.jackknife();
+  jackknife_t jackknifedense= dense.jackknife();
+  BOOST_CHECK_CLOSE( jackknife.averages(1,0), jackknifedense.averages(1,0), 
+		     1.0e-6 );
+}
+
+// Mutated combination agrees with one from a parser with the same inputs:
+BOOST_AUTO_TEST_CASE( testMutators ) {
+  BOOST_MESSAGE( "testMutators" );
+  Blue blue( "test.txt" );
+  blue.getErrors();
+  blue.setValue( 0, 172.0 );
+  blue.removeErrorSource( "04err4" );
+  blue.setError( "00stat", 2, 0.5 );
+  AverageDataParser parser( "test.txt" );
+  parser.setValue( 0, 172.0 );
+  parser.removeErrorSource( "04err4" );
+  parser.setError( "00stat", 2, 0.5 );
+  Blue expected( parser );
+  BOOST_CHECK_CLOSE( blue.getAverage()[0], expected.getAverage()[0], 
+		     1.0e-6 );
+  BOOST_CHECK_CLOSE( blue.getChisq(), expected.getChisq(), 1.0e-6 );
+  BOOST_CHECK_EQUAL( blue.getErrors().size(), size_t( 6 ) );
+  BOOST_CHECK_CLOSE( blue.getErrors().find( "total" )->second(0,0), 
+		     expected.getErrors().find( "total" )->second(0,0), 
+		     1.0e-6 );
+  Double_t before= blue.getAverage()[0];
+  blue.setValue( 1, 180.0 );
+  BOOST_CHECK( blue.getAverage()[0] != before );
+  BOOST_CHECK_THROW( blue.setValue( 5, 1.0 ), std::exception );
+}
+
+// Factor updates for new errors and correlations agree with a new
+// factorisation, a downdate to a not positive definite matrix throws:
+BOOST_AUTO_TEST_CASE( testMutatorFactorUpdates ) {
+  BOOST_MESSAGE( "testMutatorFactorUpdates" );
+  Blue blue( "test.txt" );
+  blue.getCholeskyFactor();
+  blue.setCorrelation( "00stat", 0, 2, 0.3 );
+  blue.setError( "01err1", 1, 0.8 );
+  blue.setError( "04err4", 0, 4.0 );
+  AverageDataParser parser( "test.txt" );
+  parser.setCorrelation( "00stat", 0, 2, 0.3 );
+  parser.setError( "01err1", 1, 0.8 );
+  parser.setError( "04err4", 0, 4.0 );
+  Blue expected( parser );
+  const TMatrixD& upper= blue.getCholeskyFactor();
+  const TMatrixD& expectedupper= expected.getCholeskyFactor();
+  for( Int_t irow= 0; irow < 3; irow++ ) {
+    for( Int_t icol= irow; icol < 3; icol++ ) {
+      BOOST_CHECK_CLOSE( upper(irow,icol), expectedupper(irow,icol), 
+			 1.0e-6 );
+    }
+  }
+  BOOST_CHECK_CLOSE( blue.getAverage()[0], expected.getAverage()[0], 
+		     1.0e-6 );
+  BOOST_CHECK_CLOSE( blue.getChisq(), expected.getChisq(), 1.0e-6 );
+  BOOST_CHECK_THROW( blue.setCorrelation( "00stat", 0, 1, 50.0 ), 
+		     std::exception );
+}
+
+// Uncorrelated groups of valassi2.txt are solved as separate blocks:
+BOOST_AUTO_TEST_CASE( testgetBlocks ) {
+  BOOST_MESSAGE( "testgetBlocks" );
+  Blue blue( "valassi2.txt" );
+  const vector< vector<Int_t> >& blocks= blue.getBlocks();
+  BOOST_CHECK_EQUAL( blocks.size(), size_t( 3 ) );
+  BOOST_CHECK_EQUAL( blocks[0].size(), size_t( 2 ) );
+  BOOST_CHECK_EQUAL( blocks[2][0], 3 );
+  const TVectorD& average= blue.getAverage();
+  BOOST_CHECK_CLOSE( average[0], 97.2/9.1, 1.0e-6 );
+  BOOST_CHECK_CLOSE( average[1], 11.75, 1.0e-6 );
+  TVectorD errors= blue.getTotalErrors();
+  BOOST_CHECK_CLOSE( errors[0], sqrt( 8.7975/9.1 ), 1.0e-6 );
+  BOOST_CHECK_CLOSE( errors[1], sqrt( 4.5 ), 1.0e-6 );
+  Blue single( "test.txt" );
+  BOOST_CHECK_EQUAL( single.getBlocks().size(), size_t( 1 ) );
+}
+
+// Measurements appended and removed one by one agree with combinations
+// of the full and reduced inputs:
+BOOST_AUTO_TEST_CASE( testAddRemoveMeasurement ) {
+  BOOST_MESSAGE( "testAddRemoveMeasurement" );
+  Blue full( "test.txt" );
+  AverageDataParser parser( "test.txt" );
+  parser.removeMeasurement( 2 );
+  Blue streamed( parser );
+  ValueMap errors;
+  errors["00stat"]= 0.4;
+  errors["01err1"]= 1.5;
+  errors["02err2"]= 1.9;
+  errors["03err3"]= 3.5;
+  errors["04err4"]= 3.3;
+  StringMap correlations;
+  correlations["00stat"]= "0 0";
+  correlations["01err1"]= "p p";
+  correlations["02err2"]= "f f";
+  streamed.addMeasurement( "Val3", 174.5, errors, correlations );
+  BOOST_CHECK_EQUAL( streamed.getParser().getNames()[2], "Val3" );
+  BOOST_CHECK_CLOSE( streamed.getAverage()[0], full.getAverage()[0], 
+		     1.0e-6 );
+  BOOST_CHECK_CLOSE( streamed.getChisq(), full.getChisq(), 1.0e-6 );
+  BOOST_CHECK_CLOSE( streamed.getErrors().find( "02err2" )->second(0,0),
+		     full.getErrors().find( "02err2" )->second(0,0), 
+		     1.0e-6 );
+  streamed.removeMeasurement( 0 );
+  AverageDataParser reduced( "test.txt" );
+  reduced.removeMeasurement( 0 );
+  Blue expected( reduced );
+  BOOST_CHECK_CLOSE( streamed.getAverage()[0], expected.getAverage()[0], 
+		     1.0e-6 );
+  BOOST_CHECK_CLOSE( streamed.getTotalErrors()[0], 
+		     expected.getTotalErrors()[0], 1.0e-6 );
+  BOOST_CHECK_CLOSE( streamed.getCholeskyFactor()(1,1), 
+		     expected.getCholeskyFactor()(1,1), 1.0e-6 );
+  BOOST_CHECK_THROW( streamed.removeMeasurement( 2 ), std::exception );
+  BOOST_CHECK_THROW( streamed.addMeasurement( "Val4", 172.0, ValueMap() ), 
+		     std::exception );
+  BOOST_CHECK_EQUAL( streamed.getParser().getNames().size(), size_t( 2 ) );
+}
+
+// Jackknife rows with gp and gpr sources agree with combinations of the
+// reduced inputs, the minimum errors change with the removed measurement:
+BOOST_AUTO_TEST_CASE( testjackknifeGlobalSources ) {
+  BOOST_MESSAGE( "testjackknifeGlobalSources" );
+  Blue blue( "testOptions.txt" );
+  jackknife_t obtained= blue.jackknife();
+  for( Int_t ivar= 0; ivar < 3; ivar++ ) {
+    AverageDataParser parser( "testOptions.txt" );
+    parser.removeMeasurement( ivar );
+    Blue expected( parser );
+    BOOST_CHECK( obtained.valid[ivar] );
+    BOOST_CHECK_CLOSE( obtained.averages(ivar,0), expected.getAverage()[0], 
+		       1.0e-6 );
+    BOOST_CHECK_CLOSE( obtained.errors(ivar,0), 
+		       expected.getTotalErrors()[0], 1.0e-6 );
+    BOOST_CHECK_CLOSE( obtained.chisq[ivar], expected.getChisq(), 1.0e-6 );
+  }
+}
+
+// Analytic derivatives agree with central differences of combinations
+// with shifted errors, including the common part of gp and gpr:
+static void checkSensitivities( const string& filename, 
+				const vector<string>& keys ) {
+  Blue blue( filename );
+  sensitivity_t sensitivities= blue.getSensitivities();
+  BOOST_CHECK_CLOSE( sensitivities.values(0,1), 
+		     blue.getWeightsMatrix()(0,1), 1.0e-9 );
+  Double_t step= 1.0e-5;
+  for( size_t ikey= 0; ikey < keys.size(); ikey++ ) {
+    const TMatrixD& daverage= sensitivities.averages[keys[ikey]];
+    const TMatrixD& derror= sensitivities.errors[keys[ikey]];
+    for( Int_t ivar= 0; ivar < 3; ivar++ ) {
+      const VectorMap& errors= blue.getParser().getErrors();
+      Double_t error= errors.find( keys[ikey] )->second[ivar];
+      AverageDataParser up( filename );
+      up.setError( keys[ikey], ivar, error+step );
+      AverageDataParser down( filename );
+      down.setError( keys[ikey], ivar, error-step );
+      Blue blueup( up );
+      Blue bluedown( down );
+      Double_t numaverage= ( blueup.getAverage()[0] - 
+			     bluedown.getAverage()[0] )/( 2.0*step );
+      Double_t numerror= ( blueup.getTotalErrors()[0] - 
+			   bluedown.getTotalErrors()[0] )/( 2.0*step );
+      BOOST_CHECK_SMALL( daverage(0,ivar) - numaverage, 1.0e-5 );
+      BOOST_CHECK_SMALL( derror(0,ivar) - numerror, 1.0e-5 );
+    }
+  }
+}
+BOOST_AUTO_TEST_CASE( testgetSensitivities ) {
+  BOOST_MESSAGE( "testgetSensitivities" );
+  vector<string> keys;
+  keys.push_back( "00stat" );
+  keys.push_back( "01err1" );
+  keys.push_back( "02err2" );
+  keys.push_back( "03err3" );
+  keys.push_back( "04err4" );
+  checkSensitivities( "test.txt", keys );
+  keys.clear();
+  keys.push_back( "02errb" );
+  keys.push_back( "03errc" );
+  checkSensitivities( "testOptions.txt", keys );
+}
+
 // Blue Printing tests:
 
 class BluePrintTestFixture {
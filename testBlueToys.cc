@@ -0,0 +1,66 @@
+// Unit tests for BlueToys
+
+#include "BlueToys.hh"
+
+// C++:
+#include <string>
+#include <math.h>
+
+// BOOST test stuff:
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE bluetoystests
+#include <boost/test/unit_test.hpp>
+
+// Namespaces:
+using std::string;
+
+class BlueToysTestFixture {
+public:
+  BlueToysTestFixture() : blue( "test.txt" ), toys( blue ) {
+    toys.generate( 20000, 12345 );
+  }
+  Blue blue;
+  BlueToys toys;
+};
+
+BOOST_FIXTURE_TEST_SUITE( bluetoyssuite, BlueToysTestFixture )
+
+BOOST_AUTO_TEST_CASE( testgetNtoys ) {
+  BOOST_MESSAGE( "testgetNtoys" );
+  BOOST_CHECK_EQUAL( toys.getNtoys(), 20000 );
+}
+
+BOOST_AUTO_TEST_CASE( testgetAverageMoments ) {
+  BOOST_MESSAGE( "testgetAverageMoments" );
+  const ToyMoments& moments= toys.getAverageMoments( 0 );
+  Double_t error= 2.9668615983552984;
+  BOOST_CHECK_SMALL( moments.getMean() - 170.709197, 5.0*error/sqrt( 20000.0 ) );
+  BOOST_CHECK_CLOSE( moments.getRms(), error, 3.0 );
+}
+
+BOOST_AUTO_TEST_CASE( testgetChisqMoments ) {
+  BOOST_MESSAGE( "testgetChisqMoments" );
+  BOOST_CHECK_CLOSE( toys.getChisqMoments().getMean(), 2.0, 5.0 );
+}
+
+BOOST_AUTO_TEST_CASE( testgetCoverage ) {
+  BOOST_MESSAGE( "testgetCoverage" );
+  BOOST_CHECK_SMALL( toys.getCoverage( 0 ) - 0.6827, 0.02 );
+}
+
+BOOST_AUTO_TEST_CASE( testThreadIndependence ) {
+  BOOST_MESSAGE( "testThreadIndependence" );
+  BlueToys toys1( blue );
+  toys1.generate( 5500, 4711, 1 );
+  BlueToys toys4( blue );
+  toys4.generate( 5500, 4711, 4 );
+  BOOST_CHECK_EQUAL( toys1.getNtoys(), toys4.getNtoys() );
+  for( Int_t ibin= 0; ibin <= toys1.getProbHistogram().getNbins()+1; ibin++ ) {
+    BOOST_CHECK_EQUAL( toys1.getProbHistogram().getBinContent( ibin ),
+		       toys4.getProbHistogram().getBinContent( ibin ) );
+  }
+  BOOST_CHECK_CLOSE( toys1.getAverageMoments( 0 ).getMean(),
+		     toys4.getAverageMoments( 0 ).getMean(), 1.0e-8 );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,82 @@
+// Unit tests for the linear algebra backends
+
+#include "LinearAlgebra.hh"
+#include "Blue.hh"
+
+// C++:
+#include <string>
+#include <exception>
+
+// ROOT includes:
+#include "TMatrixD.h"
+#include "TMatrixDSym.h"
+
+// BOOST test stuff:
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE linearalgebratests
+#include <boost/test/unit_test.hpp>
+
+// Namespaces:
+using std::string;
+
+// Covariance and weights of test.txt as inputs:
+class LinearAlgebraTestFixture {
+public:
+  LinearAlgebraTestFixture() : blue( "test.txt" ), 
+    cov( blue.getParser().getTotalCovariances() ) {}
+  ~LinearAlgebraTestFixture() { setLinearAlgebra( "root" ); }
+  void checkBackend( const string& name ) {
+    setLinearAlgebra( name );
+    LinearAlgebra& backend= getLinearAlgebra();
+    BOOST_CHECK_EQUAL( backend.getName(), name );
+    TMatrixD upper;
+    BOOST_CHECK( backend.cholesky( cov, upper ) );
+    TMatrixD utu( upper, TMatrixD::kTransposeMult, upper );
+    BOOST_CHECK_EQUAL( upper(2,0), 0.0 );
+    for( Int_t i= 0; i < 3; i++ ) {
+      for( Int_t j= 0; j < 3; j++ ) {
+	BOOST_CHECK_CLOSE( utu(i,j), cov(i,j), 1.0e-9 );
+      }
+    }
+    TMatrixD unit( 3, 3 );
+    unit.UnitMatrix();
+    backend.choleskySolve( upper, unit );
+    TMatrixD product( cov, TMatrixD::kMult, unit );
+    BOOST_CHECK_CLOSE( product(1,1), 1.0, 1.0e-9 );
+    BOOST_CHECK_SMALL( product(0,2), 1.0e-9 );
+    const TMatrixD& weights= blue.getWeightsMatrix();
+    TMatrixDSym similarity= backend.similarity( weights, cov );
+    BOOST_CHECK_CLOSE( sqrt( similarity(0,0) ), 
+		       blue.getTotalErrors()[0], 1.0e-9 );
+    TMatrixD wcov( 1, 3 );
+    backend.multiply( weights, cov, wcov );
+    TMatrixD expected( weights, TMatrixD::kMult, cov );
+    BOOST_CHECK_CLOSE( wcov(0,1), expected(0,1), 1.0e-9 );
+    TMatrixDSym singular( 2 );
+    BOOST_CHECK( not backend.cholesky( singular, upper ) );
+  }
+  Blue blue;
+  TMatrixDSym cov;
+};
+
+BOOST_FIXTURE_TEST_SUITE( linearalgebrasuite, LinearAlgebraTestFixture )
+
+BOOST_AUTO_TEST_CASE( testRootBackend ) {
+  BOOST_MESSAGE( "testRootBackend" );
+  checkBackend( "root" );
+  BOOST_CHECK_THROW( setLinearAlgebra( "nosuchbackend" ), std::exception );
+}
+
+#ifdef AVERAGETOOLS_LAPACK
+BOOST_AUTO_TEST_CASE( testLapackBackend ) {
+  BOOST_MESSAGE( "testLapackBackend" );
+  checkBackend( "lapack" );
+  Blue lapackblue( "test.txt" );
+  BOOST_CHECK_CLOSE( lapackblue.getAverage()[0], blue.getAverage()[0], 
+		     1.0e-9 );
+  BOOST_CHECK_CLOSE( lapackblue.getErrors().find( "03err3" )->second(0,0),
+		     blue.getErrors().find( "03err3" )->second(0,0), 1.0e-9 );
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,161 @@
+// Unit tests for MinuitScheduler
+
+#include "MinuitScheduler.hh"
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <stdexcept>
+
+// BOOST test stuff:
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE minuitschedulertests
+#include <boost/test/unit_test.hpp>
+#include <boost/test/floating_point_comparison.hpp>
+
+// Namespaces:
+using std::string;
+using std::vector;
+
+// Average of three measurements with one common systematic as a 
+// nuisance parameter, the measurements are shifted by offset:
+class schedulermsf: public MinuitSolverFunction {
+public:
+  schedulermsf( Double_t offset ) : m_offset( offset ) {}
+  void operator()( Int_t& npar, Double_t* grad, Double_t& fval, 
+		   Double_t* pars, Int_t iflag ) {
+    Double_t mtop[3]= { 171.5, 173.1, 174.5 };
+    Double_t stat[3]= { 0.3, 0.33, 0.4 };
+    Double_t erra[3]= { 1.1, 1.3, 1.5 };
+    fval= pars[1]*pars[1];
+    for( Int_t ival= 0; ival < 3; ival++ ) {
+      Double_t term= ( mtop[ival] + m_offset - pars[0] + 
+		       erra[ival]*pars[1] )/stat[ival];
+      fval+= term*term;
+    }
+    return;
+  }
+private:
+  Double_t m_offset;
+};
+
+class MinuitSchedulerTestFixture {
+public:
+  MinuitSchedulerTestFixture() : pars( 2 ), parerrors( 2 ) {
+    pars[0]= 172.0;
+    pars[1]= 0.0;
+    parerrors[0]= 2.0;
+    parerrors[1]= 1.0;
+    parnames.push_back( "average" );
+    parnames.push_back( "pa" );
+    for( Int_t ifit= 0; ifit < 20; ifit++ ) {
+      functions.push_back( schedulermsf( 0.1*ifit ) );
+    }
+    for( Int_t ifit= 0; ifit < 20; ifit++ ) {
+      jobs.push_back( MinuitFitJob( functions[ifit], parnames, pars, 
+				    parerrors, 1 ) );
+    }
+  }
+  virtual ~MinuitSchedulerTestFixture() {}
+  TVectorD pars;
+  TVectorD parerrors;
+  vector<string> parnames;
+  vector<schedulermsf> functions;
+  vector<MinuitFitJob> jobs;
+};
+
+BOOST_FIXTURE_TEST_SUITE( minuitschedulersuite, MinuitSchedulerTestFixture )
+
+// Shifting all measurements shifts the average, errors and chi^2 stay:
+BOOST_AUTO_TEST_CASE( testrun ) {
+  BOOST_MESSAGE( "testrun" );
+  minuitfit_t expected= jobs[0].run();
+  BOOST_CHECK_EQUAL( expected.status, 3 );
+  MinuitScheduler scheduler( 4 );
+  BOOST_CHECK_EQUAL( scheduler.getNthreads(), 4u );
+  vector<minuitfit_t> results= scheduler.run( jobs );
+  BOOST_CHECK_EQUAL( results.size(), jobs.size() );
+  for( size_t ifit= 0; ifit < results.size(); ifit++ ) {
+    BOOST_CHECK_EQUAL( results[ifit].status, 3 );
+    BOOST_CHECK( results[ifit].error.empty() );
+    BOOST_CHECK_CLOSE( results[ifit].pars[0], 
+		       expected.pars[0] + 0.1*ifit, 1.0e-4 );
+    BOOST_CHECK_CLOSE( results[ifit].parerrors[0], 
+		       expected.parerrors[0], 1.0e-4 );
+    BOOST_CHECK_CLOSE( results[ifit].chisq, expected.chisq, 1.0e-4 );
+  }
+}
+
+// Callback counts results and sums the averages:
+class CountingCallback {
+public:
+  CountingCallback( std::mutex& mutex, Int_t& nresults, Double_t& sum ) : 
+    m_mutex( mutex ), m_nresults( nresults ), m_sum( sum ) {}
+  void operator()( const minuitfit_t& result ) {
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_nresults++;
+    m_sum+= result.pars[0];
+  }
+private:
+  std::mutex& m_mutex;
+  Int_t& m_nresults;
+  Double_t& m_sum;
+};
+
+BOOST_AUTO_TEST_CASE( testsubmit ) {
+  BOOST_MESSAGE( "testsubmit" );
+  MinuitScheduler scheduler( 3 );
+  std::future<minuitfit_t> future= scheduler.submit( jobs[5] );
+  std::mutex mutex;
+  Int_t nresults= 0;
+  Double_t sum= 0.0;
+  CountingCallback callback( mutex, nresults, sum );
+  for( size_t ifit= 0; ifit < jobs.size(); ifit++ ) {
+    scheduler.submit( jobs[ifit], callback );
+  }
+  scheduler.wait();
+  BOOST_CHECK_EQUAL( nresults, 20 );
+  minuitfit_t result= future.get();
+  minuitfit_t expected= jobs[5].run();
+  BOOST_CHECK_CLOSE( result.pars[0], expected.pars[0], 1.0e-4 );
+  Double_t expsum= 0.0;
+  for( size_t ifit= 0; ifit < jobs.size(); ifit++ ) {
+    expsum+= expected.pars[0] + 0.1*( Double_t( ifit ) - 5.0 );
+  }
+  BOOST_CHECK_CLOSE( sum, expsum, 1.0e-4 );
+}
+
+// Failing fits report the error instead of throwing:
+BOOST_AUTO_TEST_CASE( testfailedjob ) {
+  BOOST_MESSAGE( "testfailedjob" );
+  MinuitScheduler scheduler( 2 );
+  MinuitFitJob badjob( functions[0], parnames, pars, parerrors, 1, 1 );
+  minuitfit_t result= scheduler.submit( badjob ).get();
+  BOOST_CHECK_EQUAL( result.status, -1 );
+  BOOST_CHECK( result.error.find( "maxpars" ) != string::npos );
+}
+
+// Exceptions of any type from the function give status -1, those from
+// callbacks are rethrown by the future:
+class throwingmsf: public MinuitSolverFunction {
+public:
+  void operator()( Int_t&, Double_t*, Double_t&, Double_t*, Int_t ) {
+    throw 1;
+  }
+};
+void throwingCallback( const minuitfit_t& ) {
+  throw std::runtime_error( "callback" );
+}
+BOOST_AUTO_TEST_CASE( testexceptions ) {
+  BOOST_MESSAGE( "testexceptions" );
+  MinuitScheduler scheduler( 2 );
+  throwingmsf msf;
+  MinuitFitJob throwingjob( msf, parnames, pars, parerrors, 1 );
+  minuitfit_t result= scheduler.submit( throwingjob ).get();
+  BOOST_CHECK_EQUAL( result.status, -1 );
+  BOOST_CHECK( not result.error.empty() );
+  std::future<void> future= scheduler.submit( jobs[0], throwingCallback );
+  BOOST_CHECK_THROW( future.get(), std::runtime_error );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,8 +3,10 @@
 // S. Kluth, 9/2012
 
 #include "MinuitSolver.hh"
+#include "Parallel.hh"
 
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -66,6 +68,96 @@ private:
   TVectorD m_mtop, m_stat, m_erra, m_errb, m_errc;
 };
 
+// Same function with analytic gradient and Hessian, the chi^2 terms
+// are linear in the parameters with derivatives d_k:
+class testgradmsf: public MinuitSolverGradientFunction {
+public:
+  testgradmsf( const Double_t* mtop, const Double_t* stat, 
+	       const Double_t* erra, const Double_t* errb, 
+	       const Double_t* errc, bool wronggradient=false ) :
+    m_wronggradient( wronggradient ) {
+    for( Int_t ival= 0; ival < 3; ival++ ) {
+      m_mtop[ival]= mtop[ival];
+      m_stat[ival]= stat[ival];
+      m_derivs[ival][0]= -1.0/stat[ival];
+      m_derivs[ival][1]= erra[ival]/stat[ival];
+      m_derivs[ival][2]= errb[ival]/stat[ival];
+      m_derivs[ival][3]= errc[ival]/stat[ival];
+    }
+  }
+  Double_t term( Int_t ival, const Double_t* pars ) const {
+    Double_t result= m_mtop[ival]/m_stat[ival];
+    for( Int_t ipar= 0; ipar < 4; ipar++ ) {
+      result+= m_derivs[ival][ipar]*pars[ipar];
+    }
+    return result;
+  }
+  Double_t value( Int_t, const Double_t* pars ) {
+    Double_t fval= pars[1]*pars[1] + pars[2]*pars[2] + pars[3]*pars[3];
+    for( Int_t ival= 0; ival < 3; ival++ ) {
+      fval+= term( ival, pars )*term( ival, pars );
+    }
+    return fval;
+  }
+  void gradient( Int_t, const Double_t* pars, Double_t* grad ) {
+    for( Int_t ipar= 0; ipar < 4; ipar++ ) {
+      grad[ipar]= ipar > 0 ? 2.0*pars[ipar] : 0.0;
+      for( Int_t ival= 0; ival < 3; ival++ ) {
+	grad[ipar]+= 2.0*term( ival, pars )*m_derivs[ival][ipar];
+      }
+    }
+    if( m_wronggradient ) grad[2]*= 1.1;
+    return;
+  }
+  bool hessian( Int_t, const Double_t*, Double_t* hess ) {
+    for( Int_t ipar= 0; ipar < 4; ipar++ ) {
+      for( Int_t jpar= 0; jpar < 4; jpar++ ) {
+	Double_t sum= ipar == jpar and ipar > 0 ? 2.0 : 0.0;
+	for( Int_t ival= 0; ival < 3; ival++ ) {
+	  sum+= 2.0*m_derivs[ival][ipar]*m_derivs[ival][jpar];
+	}
+	hess[ipar*4+jpar]= sum;
+      }
+    }
+    return true;
+  }
+private:
+  Double_t m_mtop[3];
+  Double_t m_stat[3];
+  Double_t m_derivs[3][4];
+  bool m_wronggradient;
+};
+
+// Independent fits of the same function, one per index:
+class ConcurrentFitTask: public ParallelTask {
+public:
+  ConcurrentFitTask( size_t nfits, MinuitEngineType engine ) :
+    m_engine( engine ), m_chisqs( nfits ), m_averages( nfits ) {}
+  virtual void operator()( size_t index, unsigned ithread ) {
+    Double_t mtop[3]= { 171.5, 173.1, 174.5 };
+    Double_t stat[3]= { 0.3, 0.33, 0.4 };
+    Double_t erra[3]= { 1.1, 1.3, 1.5 };
+    Double_t errb[3]= { 0.9, 1.5, 1.9 };
+    Double_t errc[3]= { 2.4, 3.1, 3.5 };
+    testgradmsf gradmsf( mtop, stat, erra, errb, errc );
+    Double_t tmppar[4]= { 172.0, 0.0, 0.0, 0.0 };
+    Double_t tmpparerr[4]= { 2.0, 1.0, 1.0, 1.0 };
+    vector<string> parnames;
+    parnames.push_back( "average" );
+    parnames.push_back( "pa" );
+    parnames.push_back( "pb" );
+    parnames.push_back( "pc" );
+    MinuitSolver solver( gradmsf, parnames, TVectorD( 4, tmppar ), 
+			 TVectorD( 4, tmpparerr ), 2, true, 50, m_engine );
+    solver.solve();
+    m_chisqs[index]= solver.getChisq();
+    m_averages[index]= solver.getUpar()[0];
+  }
+  MinuitEngineType m_engine;
+  vector<Double_t> m_chisqs;
+  vector<Double_t> m_averages;
+};
+
 // Tests for MinuitSolver tests with function objects:
 
 class MinuitSolverTestFixture {
@@ -210,5 +302,211 @@ BOOST_AUTO_TEST_CASE( testMinuitSolverFCN ) {
   }
 }
 
+BOOST_AUTO_TEST_CASE( testGradientFunction ) {
+  BOOST_MESSAGE( "testGradientFunction" );
+  Double_t mtop[3]= { 171.5, 173.1, 174.5 };
+  Double_t stat[3]= { 0.3, 0.33, 0.4 };
+  Double_t erra[3]= { 1.1, 1.3, 1.5 };
+  Double_t errb[3]= { 0.9, 1.5, 1.9 };
+  Double_t errc[3]= { 2.4, 3.1, 3.5 };
+  testgradmsf gradmsf( mtop, stat, erra, errb, errc );
+  Double_t tmppar[4]= { 172.0, 0.0, 0.0, 0.0 };
+  TVectorD pars( 4, tmppar );
+  Double_t tmpparerr[4]= { 2.0, 1.0, 1.0, 1.0 };
+  TVectorD parerrors( 4, tmpparerr );
+  vector<string> parnames= minsol->getUparNames();
+  MinuitSolver gradsolver( gradmsf, parnames, pars, parerrors, 2 );
+  BOOST_CHECK_SMALL( gradsolver.checkGradient( pars ), 1.0e-6 );
+  gradsolver.solve();
+  BOOST_CHECK_CLOSE( gradsolver.getChisq(), 3.58037721, 1.0e-4 );
+  TVectorD gradpars= gradsolver.getUpar();
+  TVectorD expectedpars= minsol->getUpar();
+  TVectorD gradparerrors= gradsolver.getUparErrors();
+  TVectorD expectedparerrors= minsol->getUparErrors();
+  for( int i= 0; i < 4; i++ ) {
+    BOOST_CHECK_CLOSE( gradpars[i], expectedpars[i], 1.0e-4 );
+    BOOST_CHECK_CLOSE( gradparerrors[i], expectedparerrors[i], 1.0e-4 );
+  }
+  TMatrixDSym cov= gradsolver.getCovarianceMatrix();
+  BOOST_CHECK_CLOSE( cov(0,3), 0.74832061921642412, 1.0e-4 );
+  testgradmsf wrongmsf( mtop, stat, erra, errb, errc, true );
+  MinuitSolver wrongsolver( wrongmsf, parnames, pars, parerrors, 2 );
+  BOOST_CHECK( wrongsolver.checkGradient( pars ) > 1.0e-2 );
+  TVectorD zeroerrors( parerrors );
+  zeroerrors[2]= 0.0;
+  zeroerrors[3]= 0.0;
+  MinuitSolver zerosolver( gradmsf, parnames, pars, zeroerrors, 2 );
+  Double_t zerodiff= zerosolver.checkGradient( pars );
+  BOOST_CHECK_SMALL( zerodiff, 1.0e-6 );
+  MinuitSolver wrongzerosolver( wrongmsf, parnames, pars, zeroerrors, 2 );
+  BOOST_CHECK( wrongzerosolver.checkGradient( pars ) > 1.0e-2 );
+}
+
+// The chi^2 of fcn as a linear model, residuals 
+// ( m_i - ave + erra_i pa + errb_i pb + errc_i pc )/stat_i and pa, pb, pc:
+BOOST_AUTO_TEST_CASE( testLinearModel ) {
+  BOOST_MESSAGE( "testLinearModel" );
+  Double_t mtop[3]= { 171.5, 173.1, 174.5 };
+  Double_t stat[3]= { 0.3, 0.33, 0.4 };
+  Double_t erra[3]= { 1.1, 1.3, 1.5 };
+  Double_t errb[3]= { 0.9, 1.5, 1.9 };
+  Double_t errc[3]= { 2.4, 3.1, 3.5 };
+  TMatrixD design( 6, 4 );
+  TVectorD data( 6 );
+  TVectorD weights( 6 );
+  TMatrixDSym weightmatrix( 6 );
+  for( Int_t ival= 0; ival < 3; ival++ ) {
+    design(ival,0)= 1.0;
+    design(ival,1)= -erra[ival];
+    design(ival,2)= -errb[ival];
+    design(ival,3)= -errc[ival];
+    data[ival]= mtop[ival];
+    weights[ival]= 1.0/( stat[ival]*stat[ival] );
+    design(3+ival,1+ival)= 1.0;
+    weights[3+ival]= 1.0;
+  }
+  for( Int_t ires= 0; ires < 6; ires++ ) {
+    weightmatrix(ires,ires)= weights[ires];
+  }
+  LinearModel diagonal( design, data, weights );
+  LinearModel full( design, data, weightmatrix );
+  Double_t tmppar[4]= { 172.0, 0.0, 0.0, 0.0 };
+  TVectorD pars( 4, tmppar );
+  Double_t tmpparerr[4]= { 2.0, 1.0, 1.0, 1.0 };
+  TVectorD parerrors( 4, tmpparerr );
+  vector<string> parnames= minsol->getUparNames();
+  Double_t fval= 0.0;
+  Int_t npar= 4;
+  fcn( npar, 0, fval, tmppar, 4 );
+  BOOST_CHECK_CLOSE( diagonal.value( 4, tmppar ), fval, 1.0e-10 );
+  TVectorD expectedpars= minsol->getUpar();
+  TVectorD expectedparerrors= minsol->getUparErrors();
+  TMatrixDSym expectedcov= minsol->getCovarianceMatrix();
+  LinearModel* models[2]= { &diagonal, &full };
+  for( Int_t imodel= 0; imodel < 2; imodel++ ) {
+    MinuitSolver linsolver( *models[imodel], parnames, pars, parerrors, 2 );
+    BOOST_CHECK_SMALL( linsolver.checkGradient( pars ), 1.0e-6 );
+    linsolver.solve();
+    BOOST_CHECK_EQUAL( linsolver.getStatus(), 3 );
+    BOOST_CHECK_CLOSE( linsolver.getChisq(), 3.58037721, 1.0e-4 );
+    TVectorD linpars= linsolver.getUpar();
+    TVectorD linparerrors= linsolver.getUparErrors();
+    TMatrixDSym lincov= linsolver.getCovarianceMatrix();
+    for( int i= 0; i < 4; i++ ) {
+      BOOST_CHECK_CLOSE( linpars[i], expectedpars[i], 1.0e-4 );
+      BOOST_CHECK_CLOSE( linparerrors[i], expectedparerrors[i], 1.0e-4 );
+      for( int j= 0; j < 4; j++ ) {
+	BOOST_CHECK_CLOSE( lincov(i,j), expectedcov(i,j), 1.0e-4 );
+      }
+    }
+  }
+  // Commands after the closed form solution act on the minimiser, which
+  // starts from that solution. Commands which leave the minimum alone 
+  // keep the closed form results:
+  MinuitSolver cmdsolver( diagonal, parnames, pars, parerrors, 2 );
+  cmdsolver.solve();
+  Double_t linchisq= cmdsolver.getChisq();
+  cmdsolver.minuitCommand( "SET PRI 0" );
+  BOOST_CHECK_EQUAL( cmdsolver.getStatus(), 3 );
+  BOOST_CHECK_CLOSE( cmdsolver.getChisq(), linchisq, 1.0e-10 );
+  cmdsolver.minuitCommand( "MIGRAD" );
+  BOOST_CHECK_CLOSE( cmdsolver.getUpar()[0], expectedpars[0], 1.0e-4 );
+  BOOST_CHECK_CLOSE( cmdsolver.getChisq(), linchisq, 1.0e-4 );
+  cmdsolver.minuitCommand( "SET PAR 2 0.5" );
+  cmdsolver.minuitCommand( "FIX 2" );
+  cmdsolver.minuitCommand( "MIGRAD" );
+  BOOST_CHECK_CLOSE( cmdsolver.getUpar()[1], 0.5, 1.0e-6 );
+  BOOST_CHECK( cmdsolver.getChisq() > linchisq + 0.1 );
+  // The fixed parameter has zero error and covariance, the others the
+  // conditional covariance 2 H^-1 of the free parameters:
+  TMatrixDSym hessian( 4 );
+  diagonal.hessian( 4, tmppar, hessian.GetMatrixArray() );
+  Int_t free[3]= { 0, 2, 3 };
+  TMatrixDSym freehessian( 3 );
+  for( Int_t i= 0; i < 3; i++ ) {
+    for( Int_t j= 0; j < 3; j++ ) {
+      freehessian(i,j)= hessian(free[i],free[j]);
+    }
+  }
+  freehessian.Invert();
+  TMatrixDSym fixcov= cmdsolver.getCovarianceMatrix();
+  BOOST_CHECK_EQUAL( cmdsolver.getUparErrors()[1], 0.0 );
+  for( Int_t i= 0; i < 4; i++ ) {
+    BOOST_CHECK_EQUAL( fixcov(1,i), 0.0 );
+    BOOST_CHECK_EQUAL( fixcov(i,1), 0.0 );
+  }
+  for( Int_t i= 0; i < 3; i++ ) {
+    BOOST_CHECK_CLOSE( cmdsolver.getUparErrors()[free[i]], 
+		       sqrt( 2.0*freehessian(i,i) ), 1.0e-6 );
+    for( Int_t j= 0; j < 3; j++ ) {
+      BOOST_CHECK_CLOSE( fixcov(free[i],free[j]), 2.0*freehessian(i,j), 
+			 1.0e-6 );
+    }
+  }
+  // Inconsistent sizes:
+  TVectorD shortdata( 5 );
+  BOOST_CHECK_THROW( LinearModel( design, shortdata, weights ), 
+		     std::exception );
+  BOOST_CHECK_THROW( LinearModel( design, data, TMatrixDSym( 5 ) ), 
+		     std::exception );
+  BOOST_CHECK_THROW( diagonal.value( 3, tmppar ), std::exception );
+  Double_t grad[4];
+  BOOST_CHECK_THROW( diagonal.gradient( 3, tmppar, grad ), std::exception );
+}
+
+BOOST_AUTO_TEST_CASE( testgetResult ) {
+  BOOST_MESSAGE( "testgetResult" );
+  const MinuitResult& result= minsol->getResult();
+  BOOST_CHECK_EQUAL( result.getStatus(), 3 );
+  BOOST_CHECK_EQUAL( result.getNdof(), 2 );
+  BOOST_CHECK_CLOSE( result.getChisq(), 3.58037721, 1.0e-4 );
+  BOOST_CHECK( result.getEdm() >= 0.0 );
+  BOOST_CHECK_EQUAL( result.getParNames()[3], "pc" );
+  BOOST_CHECK_CLOSE( result.getPars()[0], 167.1022776, 1.0e-4 );
+  BOOST_CHECK_CLOSE( result.getParErrors()[0], 1.4395944, 1.0e-4 );
+  BOOST_CHECK_CLOSE( result.getCovarianceMatrix()(0,3), 
+		     0.74832061921642412, 1.0e-4 );
+  BOOST_CHECK_CLOSE( result.getCorrelationMatrix()(0,3), 
+		     0.71903860509038131, 1.0e-4 );
+  std::stringstream sstr;
+  result.write( sstr );
+  MinuitResult copy= MinuitResult::read( sstr );
+  BOOST_CHECK_EQUAL( copy.getParNames().size(), 4u );
+  BOOST_CHECK_EQUAL( copy.getStatus(), result.getStatus() );
+  BOOST_CHECK_EQUAL( copy.getChisq(), result.getChisq() );
+  for( int i= 0; i < 4; i++ ) {
+    BOOST_CHECK_EQUAL( copy.getPars()[i], result.getPars()[i] );
+    BOOST_CHECK_EQUAL( copy.getParErrors()[i], result.getParErrors()[i] );
+    for( int j= 0; j < 4; j++ ) {
+      BOOST_CHECK_EQUAL( copy.getCovarianceMatrix()(i,j), 
+			 result.getCovarianceMatrix()(i,j) );
+    }
+  }
+  std::stringstream bad( "MinuitResult 4 2" );
+  BOOST_CHECK_THROW( MinuitResult::read( bad ), std::exception );
+}
+
+BOOST_AUTO_TEST_CASE( testConcurrentFits ) {
+  BOOST_MESSAGE( "testConcurrentFits" );
+  vector<MinuitEngineType> engines;
+  engines.push_back( kTMinuit );
+#ifdef AVERAGETOOLS_MINUIT2
+  engines.push_back( kMinuit2 );
+#else
+  vector<string> parnames= minsol->getUparNames();
+  TVectorD pars= minsol->getUpar();
+  BOOST_CHECK_THROW( MinuitSolver( fcn, parnames, pars, pars, 2, true, 50, 
+				   kMinuit2 ), std::exception );
+#endif
+  for( size_t iengine= 0; iengine < engines.size(); iengine++ ) {
+    ConcurrentFitTask task( 16, engines[iengine] );
+    parallelFor( 16, task, 4 );
+    for( size_t ifit= 0; ifit < 16; ifit++ ) {
+      BOOST_CHECK_CLOSE( task.m_chisqs[ifit], 3.58037721, 1.0e-4 );
+      BOOST_CHECK_CLOSE( task.m_averages[ifit], 167.1022776, 1.0e-4 );
+    }
+  }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
@@ -0,0 +1,98 @@
+// Unit tests for the fixed size BLUE
+
+#include "SmallBlue.hh"
+#include "Blue.hh"
+
+// C++:
+#include <vector>
+#include <math.h>
+
+// BOOST test stuff:
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE smallbluetests
+#include <boost/test/unit_test.hpp>
+
+// Namespaces:
+using std::vector;
+
+// Inputs from a parser as plain arrays:
+class SmallBlueTestFixture {
+public:
+  SmallBlueTestFixture() {}
+  bool combine( const Blue& blue, smallblue_t& result ) {
+    const AverageDataParser& parser= blue.getParser();
+    TMatrixDSym cov= parser.getTotalCovariances();
+    Int_t nvar= cov.GetNrows();
+    vector<Double_t> covariance( nvar*nvar );
+    for( Int_t ivar= 0; ivar < nvar; ivar++ ) {
+      for( Int_t jvar= 0; jvar < nvar; jvar++ ) {
+	covariance[ivar*nvar+jvar]= cov(ivar,jvar);
+      }
+    }
+    const GroupMap& groups= parser.getGroupMap();
+    return combineSmall( nvar, groups.getNgroups(), 
+			 parser.getValues().GetMatrixArray(),
+			 &covariance[0], &groups.getIndices()[0], result );
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE( smallbluesuite, SmallBlueTestFixture )
+
+BOOST_AUTO_TEST_CASE( testcombineSmall ) {
+  BOOST_MESSAGE( "testcombineSmall" );
+  Blue blue( "test.txt" );
+  smallblue_t result;
+  BOOST_CHECK( combine( blue, result ) );
+  BOOST_CHECK( result.valid );
+  BOOST_CHECK_EQUAL( result.navg, 1 );
+  BOOST_CHECK_CLOSE( result.average[0], blue.getAverage()[0], 1.0e-9 );
+  BOOST_CHECK_CLOSE( result.chisq, blue.getChisq(), 1.0e-6 );
+  BOOST_CHECK_CLOSE( sqrt( result.avgcov[0][0] ), 
+		     blue.getTotalErrors()[0], 1.0e-9 );
+  for( Int_t ivar= 0; ivar < 3; ivar++ ) {
+    BOOST_CHECK_CLOSE( result.weights[0][ivar], 
+		       blue.getWeightsMatrix()(0,ivar), 1.0e-9 );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( testcombineSmallGroups ) {
+  BOOST_MESSAGE( "testcombineSmallGroups" );
+  Blue blue( "valassi2.txt" );
+  smallblue_t result;
+  BOOST_CHECK( combine( blue, result ) );
+  BOOST_CHECK_EQUAL( result.navg, 2 );
+  BOOST_CHECK_CLOSE( result.average[0], 97.2/9.1, 1.0e-9 );
+  BOOST_CHECK_CLOSE( result.average[1], 11.75, 1.0e-9 );
+  BOOST_CHECK_CLOSE( result.avgcov[1][1], 4.5, 1.0e-9 );
+}
+
+BOOST_AUTO_TEST_CASE( testcombineSmallLimits ) {
+  BOOST_MESSAGE( "testcombineSmallLimits" );
+  vector<Double_t> values( maxSmallVar+1, 1.0 );
+  vector<Double_t> covariance( (maxSmallVar+1)*(maxSmallVar+1), 0.0 );
+  vector<Int_t> groups( maxSmallVar+1, 0 );
+  smallblue_t result;
+  BOOST_CHECK( not combineSmall( maxSmallVar+1, 1, &values[0], 
+				 &covariance[0], &groups[0], result ) );
+  BOOST_CHECK( combineSmall( 2, 1, &values[0], &covariance[0], 
+			     &groups[0], result ) );
+  BOOST_CHECK( not result.valid );
+}
+
+BOOST_AUTO_TEST_CASE( testcombineSmallGroupIndex ) {
+  BOOST_MESSAGE( "testcombineSmallGroupIndex" );
+  Double_t values[3]= { 1.0, 2.0, 3.0 };
+  Double_t covariance[9]= { 1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0 };
+  Int_t groups[3]= { 0, 1, 2 };
+  smallblue_t result;
+  BOOST_CHECK( not combineSmall( 3, 2, values, covariance, groups, 
+				 result ) );
+  groups[2]= -1;
+  BOOST_CHECK( not combineSmall( 3, 2, values, covariance, groups, 
+				 result ) );
+  groups[2]= 1;
+  BOOST_CHECK( combineSmall( 3, 2, values, covariance, groups, result ) );
+  BOOST_CHECK( result.valid );
+}
+
+BOOST_AUTO_TEST_SUITE_END()